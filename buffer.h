@@ -2,13 +2,24 @@
 #define BUFFER_H
 
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <string>
+#include <vector>
+#include "capture.h"
+#include "draw.h"
+#include "sprite.h"
+#include "image.h"
+#include "span.h"
 
 class Buffer {
   public:
     Buffer(const int width, const int height) {
       allocated = true;
+      m_data = new uint32_t[width*height];
       m_width = width;
       m_height = height;
     }
@@ -21,8 +32,11 @@ class Buffer {
     ~Buffer() {
       if (allocated) delete[] m_data;
     }
-    void clear() {
-      memset(m_data, 0, m_width*m_height*sizeof(uint32_t));
+    uint32_t *getData() const { return m_data; }
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    void clear(uint32_t colour = 0) {
+      Pixie::FillSpan(m_data, m_width*m_height, colour);
     }
     void setPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) {
       if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
@@ -43,58 +57,96 @@ class Buffer {
       g = (color&0x0000ff00)>>8;
       b = (color&0x000000ff);
     }
+    // Draw src onto this buffer with its top left corner at (x, y), see Pixie::Blit
+    void blit(const Buffer &src, int x, int y, Pixie::BlitMode mode = Pixie::BlitMode_Alpha, uint32_t colourKey = 0) {
+      Pixie::DrawTarget target(m_data, m_width, m_height);
+      Pixie::Blit(target, Pixie::DrawTarget(src.m_data, src.m_width, src.m_height), x, y, mode, colourKey);
+    }
+    // Draw an encoded sprite onto this buffer with its top left corner at (x, y)
+    void blit(const Pixie::RleSprite &sprite, int x, int y) {
+      sprite.Draw(Pixie::DrawTarget(m_data, m_width, m_height), x, y);
+    }
+    // Multiply the colours by the alpha set with setPixel, ready to blit with BlitMode_Alpha
+    void premultiplyAlpha() {
+      Pixie::PremultiplyAlpha(m_data, m_width*m_height);
+    }
     // Save buffer as bmp file
-    void saveAsBMP(const char *filename) {
+    bool saveAsBMP(const char *filename) const {
+      return writeBMP(filename, m_data, m_width, m_height);
+    }
+    // Save buffer as png file, a lot smaller than bmp for screenshots
+    bool saveAsPNG(const char *filename) const {
+      return Pixie::SavePNG(filename, m_data, m_width, m_height);
+    }
+    // Save buffer as qoi file, faster than png but not as small
+    bool saveAsQOI(const char *filename) const {
+      return Pixie::SaveQOI(filename, m_data, m_width, m_height);
+    }
+    // Load a frame from a capture file, e.g. to diff it against what's drawn now. The capture
+    // must be the same size as the buffer.
+    bool loadCaptureFrame(Pixie::CapturePlayer &player, int frame) {
+      if (player.GetWidth() != m_width || player.GetHeight() != m_height) {
+          return false;
+      }
+      return player.ReadFrame(frame, m_data);
+    }
+    // Snapshot the buffer and save it as a bmp file on a background thread, so the caller can
+    // keep drawing into the buffer straight away. The future holds whether the write succeeded.
+    std::future<bool> saveAsBMPAsync(const char *filename) const {
+      std::vector<uint32_t> pixels(m_data, m_data + (size_t)m_width*m_height);
+      std::string path(filename);
+      int width = m_width, height = m_height;
+      return std::async(std::launch::async, [pixels = std::move(pixels), path, width, height]() {
+        return writeBMP(path.c_str(), pixels.data(), width, height);
+      });
+    }
+  private:
+#pragma pack(push, 1)
+    // BMP file header followed by the info header, as laid out in the file.
+    struct BMPHeader {
+      uint16_t fileType;
+      uint32_t fileSize;
+      uint16_t reserved1;
+      uint16_t reserved2;
+      uint32_t dataOffset;
+      uint32_t infoHeaderSize;
+      int32_t imageWidth;
+      int32_t imageHeight;
+      uint16_t planes;
+      uint16_t bitsPerPixel;
+      uint32_t compression;
+      uint32_t imageSize;
+      int32_t xPixelsPerMeter;
+      int32_t yPixelsPerMeter;
+      uint32_t totalColors;
+      uint32_t importantColors;
+    };
+#pragma pack(pop)
+    static bool writeBMP(const char *filename, const uint32_t *data, int width, int height) {
       std::ofstream bmpFile(filename, std::ios::out | std::ios::binary);
       if (!bmpFile.is_open()) {
-          // Handle error opening file
-          return;
+          return false;
       }
-      // BMP file header
-      const uint16_t fileType = 0x4D42; // BM in little-endian
-      const uint32_t fileSize = 54 + (m_width * m_height * 4); // BMP header size + pixel data size
-      const uint16_t reserved1 = 0;
-      const uint16_t reserved2 = 0;
-      const uint32_t dataOffset = 54; // BMP header size
-      // BMP info header
-      const uint32_t infoHeaderSize = 40;
-      const int32_t imageWidth = m_width;
-      const int32_t imageHeight = m_height;
-      const uint16_t planes = 1;
-      const uint16_t bitsPerPixel = 32; // 4 bytes per pixel (ARGB)
-      const uint32_t compression = 0; // no compression
-      const uint32_t imageSize = m_width * m_height * 4; // size of the pixel data
-      const int32_t xPixelsPerMeter = 0; // not used
-      const int32_t yPixelsPerMeter = 0; // not used
-      const uint32_t totalColors = 0; // not used
-      const uint32_t importantColors = 0; // not used
-      // Write BMP file header
-      bmpFile.write(reinterpret_cast<const char*>(&fileType), sizeof(fileType));
-      bmpFile.write(reinterpret_cast<const char*>(&fileSize), sizeof(fileSize));
-      bmpFile.write(reinterpret_cast<const char*>(&reserved1), sizeof(reserved1));
-      bmpFile.write(reinterpret_cast<const char*>(&reserved2), sizeof(reserved2));
-      bmpFile.write(reinterpret_cast<const char*>(&dataOffset), sizeof(dataOffset));
-      // Write BMP info header
-      bmpFile.write(reinterpret_cast<const char*>(&infoHeaderSize), sizeof(infoHeaderSize));
-      bmpFile.write(reinterpret_cast<const char*>(&imageWidth), sizeof(imageWidth));
-      bmpFile.write(reinterpret_cast<const char*>(&imageHeight), sizeof(imageHeight));
-      bmpFile.write(reinterpret_cast<const char*>(&planes), sizeof(planes));
-      bmpFile.write(reinterpret_cast<const char*>(&bitsPerPixel), sizeof(bitsPerPixel));
-      bmpFile.write(reinterpret_cast<const char*>(&compression), sizeof(compression));
-      bmpFile.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
-      bmpFile.write(reinterpret_cast<const char*>(&xPixelsPerMeter), sizeof(xPixelsPerMeter));
-      bmpFile.write(reinterpret_cast<const char*>(&yPixelsPerMeter), sizeof(yPixelsPerMeter));
-      bmpFile.write(reinterpret_cast<const char*>(&totalColors), sizeof(totalColors));
-      bmpFile.write(reinterpret_cast<const char*>(&importantColors), sizeof(importantColors));
-      // Write pixel data (in reverse order because BMP stores pixels bottom-up)
-      for (int y = m_height - 1; y >= 0; --y) {
-          for (int x = 0; x < m_width; ++x) {
-              bmpFile.write(reinterpret_cast<const char*>(&m_data[y*m_width+x]), sizeof(uint32_t));
-          }
+      const uint32_t rowSize = width * 4;
+      BMPHeader header = {};
+      header.fileType = 0x4D42; // BM in little-endian
+      header.fileSize = sizeof(BMPHeader) + (rowSize * height);
+      header.dataOffset = sizeof(BMPHeader);
+      header.infoHeaderSize = 40;
+      header.imageWidth = width;
+      header.imageHeight = height;
+      header.planes = 1;
+      header.bitsPerPixel = 32; // 4 bytes per pixel (ARGB), no compression
+      header.imageSize = rowSize * height;
+      bmpFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      // Write pixel data a row at a time, in reverse order because BMP stores pixels bottom-up.
+      // 32 bit rows never need padding.
+      for (int y = height - 1; y >= 0; --y) {
+          bmpFile.write(reinterpret_cast<const char*>(data + (size_t)y*width), rowSize);
       }
       bmpFile.close();
+      return !bmpFile.fail();
     }
-  private:
     bool allocated;
     int m_width, m_height;
     uint32_t *m_data;
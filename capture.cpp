@@ -0,0 +1,532 @@
+#include "capture.h"
+#include "core.h"
+#include "simd.h"
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+
+using namespace Pixie;
+
+// File layout (little endian):
+//   CaptureHeader
+//   frame records: uint32 type, uint32 size, then size bytes of
+//     keyframe: the frame's pixels, run length encoded
+//     delta:    uint32 tile count, then per tile uint32 tile index, uint32 size, and the tile's
+//               pixels XORed with the previous frame, run length encoded
+//   index: one uint64 per frame, (record offset << 1) | is keyframe
+//
+// Runs are a uint32 (count << 1) | literal. A literal run is followed by count pixels, a repeat
+// by the one pixel to repeat count times.
+
+namespace
+{
+    struct CaptureHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t tileSize;
+        uint32_t keyframeInterval;
+        uint32_t frameCount;
+        uint32_t reserved;
+        uint64_t indexOffset;
+    };
+
+    const char CaptureMagic[4] = { 'P', 'X', 'C', 'P' };
+    const uint32_t CaptureVersion = 1;
+
+    // The largest tile size a player accepts. Files from CaptureWriter use TileSize; anything far
+    // beyond it is a corrupt header, and would otherwise ask for a huge tile buffer.
+    const uint32_t MaxCaptureTileSize = 256;
+
+    // Likewise the largest width or height a player accepts, well past any screen, which keeps a
+    // frame under 1GB and its pixel count well inside an int.
+    const uint32_t MaxCaptureDimension = 16384;
+
+    enum RecordType
+    {
+        RecordType_Keyframe = 0,
+        RecordType_Delta = 1
+    };
+
+    // Repeats shorter than this are cheaper as part of a literal run.
+    const size_t MinRepeat = 3;
+
+    bool Seek(FILE* file, uint64_t offset)
+    {
+#if PIXIE_PLATFORM_WIN
+        return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+        return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    bool SeekToEnd(FILE* file)
+    {
+#if PIXIE_PLATFORM_WIN
+        return _fseeki64(file, 0, SEEK_END) == 0;
+#else
+        return fseeko(file, 0, SEEK_END) == 0;
+#endif
+    }
+
+    uint64_t Tell(FILE* file)
+    {
+#if PIXIE_PLATFORM_WIN
+        return (uint64_t)_ftelli64(file);
+#else
+        return (uint64_t)ftello(file);
+#endif
+    }
+
+    void Append(std::vector<uint8_t>& out, const void* data, size_t length)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        out.insert(out.end(), bytes, bytes + length);
+    }
+
+    void AppendU32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        Append(out, &value, sizeof(value));
+    }
+
+    void EncodeRuns(const uint32_t* src, size_t count, std::vector<uint8_t>& out)
+    {
+        size_t i = 0;
+        while (i < count)
+        {
+            size_t run = 1;
+            while (i + run < count && src[i + run] == src[i])
+                run++;
+
+            if (run >= MinRepeat)
+            {
+                AppendU32(out, (uint32_t)(run << 1));
+                AppendU32(out, src[i]);
+                i += run;
+                continue;
+            }
+
+            // Gather pixels up to the start of the next repeat worth encoding as one.
+            size_t start = i;
+            i += run;
+            while (i < count)
+            {
+                run = 1;
+                while (i + run < count && run < MinRepeat && src[i + run] == src[i])
+                    run++;
+                if (run >= MinRepeat)
+                    break;
+                i += run;
+            }
+
+            AppendU32(out, (uint32_t)(((i - start) << 1) | 1));
+            Append(out, src + start, (i - start) * sizeof(uint32_t));
+        }
+    }
+
+    // Decodes exactly count pixels, returning false if the data is malformed.
+    bool DecodeRuns(const uint8_t* data, size_t size, uint32_t* dst, size_t count)
+    {
+        const uint8_t* end = data + size;
+        size_t written = 0;
+        while (written < count)
+        {
+            uint32_t header;
+            if (end - data < 4)
+                return false;
+            memcpy(&header, data, 4);
+            data += 4;
+
+            size_t run = header >> 1;
+            if (run == 0 || run > count - written)
+                return false;
+
+            if (header & 1)
+            {
+                if ((size_t)(end - data) < run * sizeof(uint32_t))
+                    return false;
+                memcpy(dst + written, data, run * sizeof(uint32_t));
+                data += run * sizeof(uint32_t);
+            }
+            else
+            {
+                uint32_t value;
+                if (end - data < 4)
+                    return false;
+                memcpy(&value, data, 4);
+                data += 4;
+                std::fill(dst + written, dst + written + run, value);
+            }
+            written += run;
+        }
+        return data == end;
+    }
+
+    // Writes a ^ b to dst and returns true if any pixel differs.
+    bool XorSpan(uint32_t* dst, const uint32_t* a, const uint32_t* b, int count)
+    {
+        int i = 0;
+        uint32_t any = 0;
+#if PIXIE_SSE2
+        __m128i anyVector = _mm_setzero_si128();
+        for ( ; i + 4 <= count; i += 4)
+        {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+            _mm_storeu_si128((__m128i*)(dst + i), x);
+            anyVector = _mm_or_si128(anyVector, x);
+        }
+        any = _mm_movemask_epi8(_mm_cmpeq_epi8(anyVector, _mm_setzero_si128())) != 0xffff;
+#endif
+        for ( ; i < count; i++)
+        {
+            dst[i] = a[i] ^ b[i];
+            any |= dst[i];
+        }
+        return any != 0;
+    }
+}
+
+CaptureWriter::CaptureWriter()
+{
+    m_file = 0;
+    m_failed = false;
+    m_width = m_height = 0;
+    m_tilesX = m_tilesY = 0;
+    m_keyframeInterval = DefaultKeyframeInterval;
+    m_position = 0;
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Close();
+}
+
+bool CaptureWriter::Open(const char* filename, int width, int height, int keyframeInterval /*= DefaultKeyframeInterval*/)
+{
+    Close();
+
+    if (width <= 0 || height <= 0)
+        return false;
+
+    m_file = fopen(filename, "wb");
+    if (!m_file)
+        return false;
+
+    m_failed = false;
+    m_width = width;
+    m_height = height;
+    m_tilesX = (width + TileSize - 1) / TileSize;
+    m_tilesY = (height + TileSize - 1) / TileSize;
+    m_keyframeInterval = std::max(keyframeInterval, 1);
+    m_previous.assign((size_t)width * height, 0);
+    m_tile.resize(TileSize * TileSize);
+    m_index.clear();
+
+    // The frame count and index offset are filled in by Close.
+    CaptureHeader header = {};
+    memcpy(header.magic, CaptureMagic, sizeof(header.magic));
+    header.version = CaptureVersion;
+    header.width = width;
+    header.height = height;
+    header.tileSize = TileSize;
+    header.keyframeInterval = m_keyframeInterval;
+    m_failed = fwrite(&header, sizeof(header), 1, m_file) != 1;
+    m_position = sizeof(header);
+
+    return !m_failed;
+}
+
+bool CaptureWriter::AddFrame(const uint32_t* pixels)
+{
+    if (!m_file)
+        return false;
+
+    bool keyframe = m_index.size() % m_keyframeInterval == 0;
+    if (keyframe || !EncodeDelta(pixels))
+    {
+        EncodeKeyframe(pixels);
+        keyframe = true;
+    }
+
+    m_index.push_back((m_position << 1) | (keyframe ? 1 : 0));
+    WriteRecord(keyframe ? RecordType_Keyframe : RecordType_Delta);
+    return !m_failed;
+}
+
+void CaptureWriter::EncodeKeyframe(const uint32_t* pixels)
+{
+    m_record.clear();
+    EncodeRuns(pixels, m_previous.size(), m_record);
+    memcpy(m_previous.data(), pixels, m_previous.size() * sizeof(uint32_t));
+}
+
+bool CaptureWriter::EncodeDelta(const uint32_t* pixels)
+{
+    m_record.clear();
+    AppendU32(m_record, 0);
+
+    uint32_t numChanged = 0;
+    uint32_t numTiles = m_tilesX * m_tilesY;
+    for (int ty = 0; ty < m_tilesY; ty++)
+    {
+        for (int tx = 0; tx < m_tilesX; tx++)
+        {
+            int x0 = tx * TileSize;
+            int y0 = ty * TileSize;
+            int tileWidth = std::min((int)TileSize, m_width - x0);
+            int tileHeight = std::min((int)TileSize, m_height - y0);
+
+            bool changed = false;
+            for (int y = 0; y < tileHeight; y++)
+            {
+                size_t offset = (size_t)(y0 + y) * m_width + x0;
+                changed |= XorSpan(&m_tile[y * tileWidth], pixels + offset, &m_previous[offset], tileWidth);
+            }
+            if (!changed)
+                continue;
+
+            // When most of the frame has changed a keyframe is about as small, and seeks faster.
+            if (++numChanged * 2 > numTiles)
+                return false;
+
+            AppendU32(m_record, ty * m_tilesX + tx);
+            size_t sizeOffset = m_record.size();
+            AppendU32(m_record, 0);
+            EncodeRuns(m_tile.data(), (size_t)tileWidth * tileHeight, m_record);
+            uint32_t size = (uint32_t)(m_record.size() - sizeOffset - 4);
+            memcpy(&m_record[sizeOffset], &size, 4);
+
+            for (int y = 0; y < tileHeight; y++)
+            {
+                size_t offset = (size_t)(y0 + y) * m_width + x0;
+                memcpy(&m_previous[offset], pixels + offset, tileWidth * sizeof(uint32_t));
+            }
+        }
+    }
+
+    memcpy(&m_record[0], &numChanged, 4);
+    return true;
+}
+
+void CaptureWriter::WriteRecord(uint32_t type)
+{
+    uint32_t header[2] = { type, (uint32_t)m_record.size() };
+    if (fwrite(header, sizeof(header), 1, m_file) != 1 || fwrite(m_record.data(), 1, m_record.size(), m_file) != m_record.size())
+        m_failed = true;
+    m_position += sizeof(header) + m_record.size();
+}
+
+bool CaptureWriter::Close()
+{
+    if (!m_file)
+        return !m_failed;
+
+    if (!m_index.empty() && fwrite(m_index.data(), sizeof(uint64_t), m_index.size(), m_file) != m_index.size())
+        m_failed = true;
+
+    CaptureHeader header = {};
+    memcpy(header.magic, CaptureMagic, sizeof(header.magic));
+    header.version = CaptureVersion;
+    header.width = m_width;
+    header.height = m_height;
+    header.tileSize = TileSize;
+    header.keyframeInterval = m_keyframeInterval;
+    header.frameCount = (uint32_t)m_index.size();
+    header.indexOffset = m_position;
+    if (!Seek(m_file, 0) || fwrite(&header, sizeof(header), 1, m_file) != 1)
+        m_failed = true;
+
+    if (fclose(m_file) != 0)
+        m_failed = true;
+    m_file = 0;
+
+    std::vector<uint32_t>().swap(m_previous);
+    std::vector<uint8_t>().swap(m_record);
+    return !m_failed;
+}
+
+CapturePlayer::CapturePlayer()
+{
+    m_file = 0;
+    m_width = m_height = 0;
+    m_tileSize = 0;
+    m_fileSize = 0;
+    m_currentFrame = -1;
+}
+
+CapturePlayer::~CapturePlayer()
+{
+    Close();
+}
+
+bool CapturePlayer::Open(const char* filename)
+{
+    Close();
+
+    m_file = fopen(filename, "rb");
+    if (!m_file)
+        return false;
+
+    CaptureHeader header;
+    if (fread(&header, sizeof(header), 1, m_file) != 1 || memcmp(header.magic, CaptureMagic, sizeof(header.magic)) != 0 ||
+        header.version != CaptureVersion || header.width == 0 || header.height == 0 ||
+        header.width > MaxCaptureDimension || header.height > MaxCaptureDimension || header.tileSize == 0 ||
+        header.tileSize > MaxCaptureTileSize || (header.tileSize & (header.tileSize - 1)) != 0)
+    {
+        Close();
+        return false;
+    }
+
+    m_width = header.width;
+    m_height = header.height;
+    m_tileSize = header.tileSize;
+
+    // Every size read from the file is checked against what's left of it before anything is
+    // allocated for it, so a corrupt file is rejected rather than asking for gigabytes.
+    m_fileSize = 0;
+    if (SeekToEnd(m_file))
+        m_fileSize = Tell(m_file);
+
+    if (header.indexOffset != 0)
+    {
+        if (header.frameCount > INT_MAX || header.indexOffset < sizeof(header) || header.indexOffset > m_fileSize ||
+            (uint64_t)header.frameCount > (m_fileSize - header.indexOffset) / sizeof(uint64_t))
+        {
+            Close();
+            return false;
+        }
+
+        m_offsets.resize(header.frameCount);
+        if (!Seek(m_file, header.indexOffset) || fread(m_offsets.data(), sizeof(uint64_t), m_offsets.size(), m_file) != m_offsets.size())
+        {
+            Close();
+            return false;
+        }
+    }
+    else
+    {
+        // The writer never closed the file (e.g. the process was killed), so rebuild the index
+        // from the frame records. A partly written last frame is ignored.
+        uint64_t position = sizeof(header);
+        uint32_t record[2];
+        while (position + sizeof(record) <= m_fileSize && Seek(m_file, position) && fread(record, sizeof(record), 1, m_file) == 1)
+        {
+            uint64_t next = position + sizeof(record) + record[1];
+            if (next > m_fileSize)
+                break;
+            m_offsets.push_back((position << 1) | (record[0] == RecordType_Keyframe ? 1 : 0));
+            position = next;
+        }
+    }
+
+    for (size_t i = 0; i < m_offsets.size(); i++)
+    {
+        if (m_offsets[i] & 1)
+            m_keyframes.push_back((int)i);
+    }
+
+    // Frames before the first keyframe can't be decoded, the writer always starts with one.
+    if (m_keyframes.empty() || m_keyframes[0] != 0)
+    {
+        Close();
+        return false;
+    }
+
+    m_current.resize((size_t)m_width * m_height);
+    m_tile.resize((size_t)m_tileSize * m_tileSize);
+    return true;
+}
+
+void CapturePlayer::Close()
+{
+    if (m_file)
+        fclose(m_file);
+    m_file = 0;
+    m_fileSize = 0;
+    m_offsets.clear();
+    m_keyframes.clear();
+    m_currentFrame = -1;
+}
+
+bool CapturePlayer::ReadFrame(int frame, uint32_t* pixels)
+{
+    if (!m_file || frame < 0 || frame >= GetFrameCount())
+        return false;
+
+    if (frame != m_currentFrame)
+    {
+        int keyframe = *(std::upper_bound(m_keyframes.begin(), m_keyframes.end(), frame) - 1);
+        int start = m_currentFrame >= keyframe && m_currentFrame < frame ? m_currentFrame + 1 : keyframe;
+        for (int i = start; i <= frame; i++)
+        {
+            if (!DecodeFrame(i))
+            {
+                m_currentFrame = -1;
+                return false;
+            }
+            m_currentFrame = i;
+        }
+    }
+
+    memcpy(pixels, m_current.data(), m_current.size() * sizeof(uint32_t));
+    return true;
+}
+
+bool CapturePlayer::DecodeFrame(int frame)
+{
+    uint32_t record[2];
+    uint64_t position = m_offsets[frame] >> 1;
+    if (position > m_fileSize || m_fileSize - position < sizeof(record) ||
+        !Seek(m_file, position) || fread(record, sizeof(record), 1, m_file) != 1)
+        return false;
+    if (record[1] > m_fileSize - position - sizeof(record))
+        return false;
+
+    m_record.resize(record[1]);
+    if (record[1] > 0 && fread(m_record.data(), 1, record[1], m_file) != record[1])
+        return false;
+
+    const uint8_t* data = m_record.data();
+    size_t size = m_record.size();
+    if (record[0] == RecordType_Keyframe)
+        return DecodeRuns(data, size, m_current.data(), m_current.size());
+
+    int tilesX = (m_width + m_tileSize - 1) / m_tileSize;
+    int tilesY = (m_height + m_tileSize - 1) / m_tileSize;
+    uint32_t numTiles;
+    if (size < 4)
+        return false;
+    memcpy(&numTiles, data, 4);
+    size_t offset = 4;
+
+    for (uint32_t i = 0; i < numTiles; i++)
+    {
+        uint32_t tile[2];
+        if (size - offset < sizeof(tile))
+            return false;
+        memcpy(tile, data + offset, sizeof(tile));
+        offset += sizeof(tile);
+        if (tile[0] >= (uint32_t)(tilesX * tilesY) || size - offset < tile[1])
+            return false;
+
+        int x0 = (tile[0] % tilesX) * m_tileSize;
+        int y0 = (tile[0] / tilesX) * m_tileSize;
+        int tileWidth = std::min(m_tileSize, m_width - x0);
+        int tileHeight = std::min(m_tileSize, m_height - y0);
+        if (!DecodeRuns(data + offset, tile[1], m_tile.data(), (size_t)tileWidth * tileHeight))
+            return false;
+        offset += tile[1];
+
+        for (int y = 0; y < tileHeight; y++)
+        {
+            uint32_t* dst = &m_current[(size_t)(y0 + y) * m_width + x0];
+            const uint32_t* src = &m_tile[y * tileWidth];
+            for (int x = 0; x < tileWidth; x++)
+                dst[x] ^= src[x];
+        }
+    }
+
+    return offset == size;
+}
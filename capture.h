@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace Pixie
+{
+    // Pixie capture files hold a keyframe every so often and, between them, only the tiles that
+    // changed since the previous frame, XORed with it. Both are run length encoded, so a mostly
+    // static dashboard costs little more than its changes. An index of frame offsets at the end
+    // of the file lets the player seek.
+    class CaptureWriter
+    {
+        public:
+            enum
+            {
+                TileSize = 64,
+                DefaultKeyframeInterval = 300
+            };
+
+            CaptureWriter();
+            ~CaptureWriter();
+
+            // Creates the capture file. Every frame added must be width x height.
+            bool Open(const char* filename, int width, int height, int keyframeInterval = DefaultKeyframeInterval);
+
+            // Appends a frame, as a keyframe or as the tiles that differ from the last frame.
+            bool AddFrame(const uint32_t* pixels);
+
+            // Writes the index and closes the file. Returns false if any write failed.
+            bool Close();
+
+        private:
+            void EncodeKeyframe(const uint32_t* pixels);
+            bool EncodeDelta(const uint32_t* pixels);
+            void WriteRecord(uint32_t type);
+
+            FILE* m_file;
+            bool m_failed;
+            int m_width;
+            int m_height;
+            int m_tilesX;
+            int m_tilesY;
+            int m_keyframeInterval;
+            uint64_t m_position;
+
+            std::vector<uint32_t> m_previous;
+            std::vector<uint32_t> m_tile;
+            std::vector<uint8_t> m_record;
+            std::vector<uint64_t> m_index;
+    };
+
+    // Reads frames back out of a capture file.
+    class CapturePlayer
+    {
+        public:
+            CapturePlayer();
+            ~CapturePlayer();
+
+            bool Open(const char* filename);
+            void Close();
+
+            int GetFrameCount() const;
+            int GetWidth() const;
+            int GetHeight() const;
+
+            // Reconstructs the given frame into pixels, which must hold width x height pixels. Decodes
+            // forward from the nearest keyframe, or from the last frame read if that's closer, so
+            // reading frames in order only decodes each one once.
+            bool ReadFrame(int frame, uint32_t* pixels);
+
+        private:
+            bool DecodeFrame(int frame);
+
+            FILE* m_file;
+            int m_width;
+            int m_height;
+            int m_tileSize;
+            uint64_t m_fileSize;
+            std::vector<uint64_t> m_offsets;
+            std::vector<int> m_keyframes;
+
+            std::vector<uint32_t> m_current;
+            int m_currentFrame;
+            std::vector<uint32_t> m_tile;
+            std::vector<uint8_t> m_record;
+    };
+
+    inline int CapturePlayer::GetFrameCount() const
+    {
+        return (int)m_offsets.size();
+    }
+
+    inline int CapturePlayer::GetWidth() const
+    {
+        return m_width;
+    }
+
+    inline int CapturePlayer::GetHeight() const
+    {
+        return m_height;
+    }
+}
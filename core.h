@@ -8,11 +8,18 @@
 //
 //#define PIXIE_NORMALISE_MAIN
 
+// Define PIXIE_PLATFORM_HEADLESS (the PIXIE_HEADLESS cmake option does this) to build
+// Pixie without a window system. Windows render to an offscreen buffer and nothing is
+// presented, which is useful for benchmarking and server-side rendering.
+//#define PIXIE_PLATFORM_HEADLESS 1
+
 #ifdef _WIN32
 #define PIXIE_PLATFORM_WIN 1
 #elif __APPLE__
 #define PIXIE_PLATFORM_OSX 1
-#else
+#elif __linux__ && !PIXIE_PLATFORM_HEADLESS
+#define PIXIE_PLATFORM_X11 1
+#elif !PIXIE_PLATFORM_HEADLESS
 #error "Unsupported platform"
 #endif
 
@@ -22,6 +29,12 @@
 #define strcpy_s(dst, size, src) snprintf(dst, size, "%s", src)
 #endif
 
+#if !PIXIE_PLATFORM_WIN && !PIXIE_PLATFORM_OSX
+#define strcat_s(dst, size, src) strncat(dst, src, (size) - strlen(dst) - 1)
+#define sprintf_s(dst, size, fmt, ...) snprintf(dst, size, fmt, __VA_ARGS__)
+#define strcpy_s(dst, size, src) snprintf(dst, size, "%s", src)
+#endif
+
 #define MAKE_RGB(r, g, b) ((b)|((g)<<8)|((r)<<16))
 
 #if PIXIE_PLATFORM_WIN
@@ -0,0 +1,655 @@
+#include "draw.h"
+#include "span.h"
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+using namespace Pixie;
+
+DrawTarget::DrawTarget(uint32_t* pixels, int width, int height) : DrawTarget(pixels, width, height, width)
+{
+}
+
+DrawTarget::DrawTarget(uint32_t* pixels, int width, int height, int pitch)
+{
+    this->pixels = pixels;
+    this->width = width;
+    this->height = height;
+    this->pitch = pitch;
+    clipX0 = 0;
+    clipY0 = 0;
+    clipX1 = width;
+    clipY1 = height;
+}
+
+void DrawTarget::SetClip(int x, int y, int width, int height)
+{
+    clipX0 = std::max(x, 0);
+    clipY0 = std::max(y, 0);
+    clipX1 = std::max(std::min(x + width, this->width), clipX0);
+    clipY1 = std::max(std::min(y + height, this->height), clipY0);
+}
+
+// Floor and ceiling of n / d for d > 0, rounding towards minus and plus infinity.
+static int64_t FloorDiv(int64_t n, int64_t d)
+{
+    return n >= 0 ? n / d : -((-n + d - 1) / d);
+}
+
+static int64_t CeilDiv(int64_t n, int64_t d)
+{
+    return n >= 0 ? (n + d - 1) / d : -(-n / d);
+}
+
+// Steps along the major axis a from a0 to a0 + da, moving one pixel along the minor axis b (in
+// direction sb) whenever the error passes half a pixel. The minor offset after i steps is
+// floor((2*i*db + da) / (2*da)), so the steps that are inside the clip rect on both axes can be
+// found up front and the loop started from the first of them.
+static void DrawLineMajor(uint32_t* pixels, int majorStride, int minorStride, int a0, int b0, int da, int db, int sb,
+    int clipA0, int clipA1, int clipB0, int clipB1, uint32_t colour)
+{
+    int64_t first = std::max(clipA0 - a0, 0);
+    int64_t last = std::min(clipA1 - 1 - a0, da);
+
+    int64_t minOffset = sb > 0 ? clipB0 - b0 : b0 - (clipB1 - 1);
+    int64_t maxOffset = sb > 0 ? clipB1 - 1 - b0 : b0 - clipB0;
+    if (db == 0)
+    {
+        if (minOffset > 0 || maxOffset < 0)
+            return;
+    }
+    else
+    {
+        first = std::max(first, CeilDiv(2*da*minOffset - da, 2*(int64_t)db));
+        last = std::min(last, FloorDiv(2*da*(maxOffset + 1) - da - 1, 2*(int64_t)db));
+    }
+    if (first > last)
+        return;
+
+    int64_t n = 2*first*db + da;
+    int offset = (int)(n / (2*da));
+    int error = (int)(n % (2*da));
+    uint32_t* dst = pixels + (a0 + first)*majorStride + (b0 + sb*offset)*minorStride;
+    int minorStep = sb*minorStride;
+    for (int64_t i = first; i <= last; i++)
+    {
+        *dst = colour;
+        dst += majorStride;
+        error += 2*db;
+        if (error >= 2*da)
+        {
+            error -= 2*da;
+            dst += minorStep;
+        }
+    }
+}
+
+void Pixie::DrawLine(const DrawTarget& target, int x0, int y0, int x1, int y1, uint32_t colour)
+{
+    if (target.clipX0 >= target.clipX1 || target.clipY0 >= target.clipY1)
+        return;
+
+    // Always step forwards along the major axis, so a line covers the same pixels whichever way
+    // round its ends are given.
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    if (dx >= dy)
+    {
+        if (x0 > x1)
+        {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+
+        // Horizontal lines are a single span.
+        if (dy == 0)
+        {
+            if (y0 < target.clipY0 || y0 >= target.clipY1)
+                return;
+            int left = std::max(x0, target.clipX0);
+            int right = std::min(x1 + 1, target.clipX1);
+            if (left < right)
+                FillSpan(target.pixels + y0*target.pitch + left, right - left, colour);
+            return;
+        }
+
+        int sy = y1 > y0 ? 1 : -1;
+        DrawLineMajor(target.pixels, 1, target.pitch, x0, y0, dx, dy, sy,
+            target.clipX0, target.clipX1, target.clipY0, target.clipY1, colour);
+    }
+    else
+    {
+        if (y0 > y1)
+        {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+
+        int sx = x1 >= x0 ? 1 : -1;
+        DrawLineMajor(target.pixels, target.pitch, 1, y0, x0, dy, dx, sx,
+            target.clipY0, target.clipY1, target.clipX0, target.clipX1, colour);
+    }
+}
+
+static inline void PlotClipped(const DrawTarget& target, int x, int y, uint32_t colour)
+{
+    if (x >= target.clipX0 && x < target.clipX1 && y >= target.clipY0 && y < target.clipY1)
+        target.pixels[y*target.pitch + x] = colour;
+}
+
+// Fills row y from x0 to x1, both included, within the clip rect.
+static inline void FillRow(const DrawTarget& target, int y, int x0, int x1, uint32_t colour)
+{
+    if (y < target.clipY0 || y >= target.clipY1)
+        return;
+    x0 = std::max(x0, target.clipX0);
+    x1 = std::min(x1 + 1, target.clipX1);
+    if (x0 < x1)
+        FillSpan(target.pixels + y*target.pitch + x0, x1 - x0, colour);
+}
+
+void Pixie::DrawCircle(const DrawTarget& target, int centreX, int centreY, int radius, uint32_t colour)
+{
+    if (radius < 0)
+        return;
+
+    // Walk the octant from the right-hand side up to the diagonal and mirror it into the others.
+    int x = radius;
+    int y = 0;
+    int error = 1 - radius;
+    while (x >= y)
+    {
+        PlotClipped(target, centreX + x, centreY + y, colour);
+        PlotClipped(target, centreX - x, centreY + y, colour);
+        PlotClipped(target, centreX + x, centreY - y, colour);
+        PlotClipped(target, centreX - x, centreY - y, colour);
+        PlotClipped(target, centreX + y, centreY + x, colour);
+        PlotClipped(target, centreX - y, centreY + x, colour);
+        PlotClipped(target, centreX + y, centreY - x, colour);
+        PlotClipped(target, centreX - y, centreY - x, colour);
+
+        y++;
+        if (error < 0)
+        {
+            error += 2*y + 1;
+        }
+        else
+        {
+            x--;
+            error += 2*(y - x) + 1;
+        }
+    }
+}
+
+void Pixie::FillCircle(const DrawTarget& target, int centreX, int centreY, int radius, uint32_t colour)
+{
+    if (radius < 0)
+        return;
+
+    // The same walk as DrawCircle. Each step gives the rows at +-y, and the rows at +-x once x is
+    // about to move in, when their span is as wide as it gets. Every row is filled once.
+    int x = radius;
+    int y = 0;
+    int error = 1 - radius;
+    while (x >= y)
+    {
+        FillRow(target, centreY + y, centreX - x, centreX + x, colour);
+        if (y != 0)
+            FillRow(target, centreY - y, centreX - x, centreX + x, colour);
+
+        int lastY = y;
+        y++;
+        if (error < 0)
+        {
+            error += 2*y + 1;
+        }
+        else
+        {
+            if (x != lastY)
+            {
+                FillRow(target, centreY + x, centreX - lastY, centreX + lastY, colour);
+                FillRow(target, centreY - x, centreX - lastY, centreX + lastY, colour);
+            }
+            x--;
+            error += 2*(y - x) + 1;
+        }
+    }
+}
+
+// Returns the first pixel whose centre is at or after v, clamped to [lo, hi].
+static inline int FirstPixelAfter(float v, int lo, int hi)
+{
+    float pixel = ceilf(v - 0.5f);
+    if (!(pixel > (float)lo))
+        return lo;
+    if (pixel > (float)hi)
+        return hi;
+    return (int)pixel;
+}
+
+// An edge running down from top to bottom. Its x at a row is always worked out from the same
+// values, so shapes sharing the edge agree on where it crosses every row.
+struct ScanEdge
+{
+    float x, y;
+    float slope;
+    int firstRow, endRow;
+    int winding;
+
+    void Set(DrawPoint top, DrawPoint bottom, const DrawTarget& target)
+    {
+        x = top.x;
+        y = top.y;
+        slope = (bottom.x - top.x) / (bottom.y - top.y);
+        firstRow = FirstPixelAfter(top.y, target.clipY0, target.clipY1);
+        endRow = FirstPixelAfter(bottom.y, target.clipY0, target.clipY1);
+    }
+
+    float GetX(int row) const
+    {
+        return x + ((float)row + 0.5f - y)*slope;
+    }
+};
+
+// Fills the pixels of a row whose centres are at or after left and before right.
+static inline void FillRowSpan(const DrawTarget& target, uint32_t* row, float left, float right, uint32_t colour)
+{
+    int x0 = FirstPixelAfter(left, target.clipX0, target.clipX1);
+    int x1 = FirstPixelAfter(right, target.clipX0, target.clipX1);
+    if (x0 < x1)
+        FillSpan(row + x0, x1 - x0, colour);
+}
+
+void Pixie::FillTriangle(const DrawTarget& target, DrawPoint p0, DrawPoint p1, DrawPoint p2, uint32_t colour)
+{
+    // Sort the corners from top to bottom. The long edge runs from p0 to p2 down one side, and
+    // the two short ones down the other.
+    if (p1.y < p0.y)
+        std::swap(p0, p1);
+    if (p2.y < p1.y)
+        std::swap(p1, p2);
+    if (p1.y < p0.y)
+        std::swap(p0, p1);
+
+    ScanEdge edges[3];
+    edges[0].Set(p0, p2, target);
+    if (edges[0].firstRow >= edges[0].endRow)
+        return;
+    edges[1].Set(p0, p1, target);
+    edges[2].Set(p1, p2, target);
+
+    for (int i = 1; i < 3; i++)
+    {
+        const ScanEdge& edge = edges[i];
+        uint32_t* row = target.pixels + edge.firstRow*target.pitch;
+        for (int y = edge.firstRow; y < edge.endRow; y++, row += target.pitch)
+        {
+            float a = edges[0].GetX(y);
+            float b = edge.GetX(y);
+            FillRowSpan(target, row, std::min(a, b), std::max(a, b), colour);
+        }
+    }
+}
+
+void Pixie::FillPolygon(const DrawTarget& target, const DrawPoint* points, int count, uint32_t colour)
+{
+    if (count < 3)
+        return;
+
+    struct Crossing
+    {
+        float x;
+        int winding;
+    };
+
+    // Kept between calls so filling doesn't allocate once they've grown.
+    static thread_local std::vector<ScanEdge> edges;
+    static thread_local std::vector<int> active;
+    static thread_local std::vector<Crossing> crossings;
+    edges.clear();
+    active.clear();
+
+    // Horizontal edges and edges between rows never cross a pixel centre, so they're left out.
+    for (int i = 0; i < count; i++)
+    {
+        DrawPoint a = points[i];
+        DrawPoint b = points[i + 1 < count ? i + 1 : 0];
+        if (a.y == b.y)
+            continue;
+
+        ScanEdge edge;
+        if (a.y < b.y)
+        {
+            edge.Set(a, b, target);
+            edge.winding = 1;
+        }
+        else
+        {
+            edge.Set(b, a, target);
+            edge.winding = -1;
+        }
+        if (edge.firstRow < edge.endRow)
+            edges.push_back(edge);
+    }
+    if (edges.empty())
+        return;
+
+    std::sort(edges.begin(), edges.end(), [](const ScanEdge& a, const ScanEdge& b) { return a.firstRow < b.firstRow; });
+    int endRow = 0;
+    for (size_t i = 0; i < edges.size(); i++)
+        endRow = std::max(endRow, edges[i].endRow);
+
+    size_t next = 0;
+    uint32_t* row = target.pixels + edges[0].firstRow*target.pitch;
+    for (int y = edges[0].firstRow; y < endRow; y++, row += target.pitch)
+    {
+        // Update the edges crossing this row.
+        for ( ; next < edges.size() && edges[next].firstRow == y; next++)
+            active.push_back((int)next);
+        active.erase(std::remove_if(active.begin(), active.end(), [y](int i) { return edges[i].endRow <= y; }), active.end());
+
+        crossings.resize(active.size());
+        for (size_t i = 0; i < active.size(); i++)
+        {
+            const ScanEdge& edge = edges[active[i]];
+            crossings[i].x = edge.GetX(y);
+            crossings[i].winding = edge.winding;
+        }
+
+        // There are only a few crossings per row, and they're mostly in order from the last row.
+        for (size_t i = 1; i < crossings.size(); i++)
+        {
+            Crossing crossing = crossings[i];
+            size_t j = i;
+            for ( ; j > 0 && crossings[j - 1].x > crossing.x; j--)
+                crossings[j] = crossings[j - 1];
+            crossings[j] = crossing;
+        }
+
+        // Fill from where the winding number leaves 0 to where it returns.
+        int winding = 0;
+        float left = 0;
+        for (size_t i = 0; i < crossings.size(); i++)
+        {
+            int previous = winding;
+            winding += crossings[i].winding;
+            if (previous == 0 && winding != 0)
+                left = crossings[i].x;
+            else if (previous != 0 && winding == 0)
+                FillRowSpan(target, row, left, crossings[i].x, colour);
+        }
+    }
+}
+
+// Converts a coverage, which may be negative depending on which way the edges wind, to an alpha
+// for blending.
+static inline uint32_t CoverageToAlpha(float coverage)
+{
+    float c = fabsf(coverage);
+    return c >= 1.0f ? 256 : (uint32_t)(c*256.0f + 0.5f);
+}
+
+void Pixie::DrawLineAA(const DrawTarget& target, DrawPoint p0, DrawPoint p1, uint32_t colour)
+{
+    // Step along the major axis a, with the minor axis b, from the lower end.
+    bool steep = fabsf(p1.y - p0.y) > fabsf(p1.x - p0.x);
+    float a0 = steep ? p0.y : p0.x;
+    float b0 = steep ? p0.x : p0.y;
+    float a1 = steep ? p1.y : p1.x;
+    float b1 = steep ? p1.x : p1.y;
+    if (a0 > a1)
+    {
+        std::swap(a0, a1);
+        std::swap(b0, b1);
+    }
+    if (!(a1 > a0))
+        return;
+
+    int clipA0 = steep ? target.clipY0 : target.clipX0;
+    int clipA1 = steep ? target.clipY1 : target.clipX1;
+    int clipB0 = steep ? target.clipX0 : target.clipY0;
+    int clipB1 = steep ? target.clipX1 : target.clipY1;
+    int majorStride = steep ? target.pitch : 1;
+    int minorStride = steep ? 1 : target.pitch;
+
+    // Only the steps where the line is within a pixel of the clip rect on the minor axis are
+    // worth taking.
+    float gradient = (b1 - b0) / (a1 - a0);
+    double first = std::max((double)floorf(a0), (double)clipA0);
+    double last = std::min((double)ceilf(a1) - 1, (double)clipA1 - 1);
+    if (gradient != 0)
+    {
+        double enter = (clipB0 - 0.5 - b0) / gradient + a0 - 0.5;
+        double leave = (clipB1 + 0.5 - b0) / gradient + a0 - 0.5;
+        if (enter > leave)
+            std::swap(enter, leave);
+        first = std::max(first, floor(enter) - 1);
+        last = std::min(last, ceil(leave) + 1);
+    }
+    if (first > last)
+        return;
+
+    for (int i = (int)first; i <= (int)last; i++)
+    {
+        float weight = std::min(a1, (float)(i + 1)) - std::max(a0, (float)i);
+        float b = b0 + ((float)i + 0.5f - a0)*gradient - 0.5f;
+        float minor = floorf(b);
+        float fraction = b - minor;
+        int pixel = (int)minor;
+
+        uint32_t* dst = target.pixels + i*majorStride + pixel*minorStride;
+        if (pixel >= clipB0 && pixel < clipB1)
+            *dst = BlendColour(*dst, colour, CoverageToAlpha(weight*(1.0f - fraction)));
+        if (pixel + 1 >= clipB0 && pixel + 1 < clipB1)
+            dst[minorStride] = BlendColour(dst[minorStride], colour, CoverageToAlpha(weight*fraction));
+    }
+}
+
+// A change in coverage at a pixel that carries on to the right along the row.
+struct CoverageCell
+{
+    int x;
+    float cover;
+};
+
+// Adds the coverage of the part of an edge crossing one row, from xA to xB, where height is how
+// far it runs down the row, negated for edges running up. Cells to the left of the clip rect are
+// gathered into its left-most one, as they still affect the coverage of the pixels inside.
+static void AddEdgeCells(std::vector<CoverageCell>& cells, float xA, float xB, float height, int clipX0, int clipX1)
+{
+    if (xA > xB)
+        std::swap(xA, xB);
+    if (xB <= (float)clipX0)
+    {
+        cells.push_back({ clipX0, height });
+        return;
+    }
+    if (xA >= (float)clipX1)
+        return;
+
+    float heightPerX = xB > xA ? height / (xB - xA) : 0.0f;
+    if (xA < (float)clipX0)
+    {
+        float left = ((float)clipX0 - xA)*heightPerX;
+        cells.push_back({ clipX0, left });
+        height -= left;
+        xA = (float)clipX0;
+    }
+    if (xB > (float)clipX1)
+    {
+        height = ((float)clipX1 - xA)*heightPerX;
+        xB = (float)clipX1;
+    }
+
+    // In each pixel crossed, the part of the edge's height to the right of it covers the pixel
+    // and the rest covers the pixels after.
+    int x = (int)floorf(xA);
+    if (xB <= (float)(x + 1))
+    {
+        float right = (xA + xB)*0.5f - (float)x;
+        cells.push_back({ x, height*(1.0f - right) });
+        cells.push_back({ x + 1, height*right });
+        return;
+    }
+
+    for (float start = xA; start < xB; x++)
+    {
+        float end = std::min((float)(x + 1), xB);
+        float piece = (end - start)*heightPerX;
+        float right = (start + end)*0.5f - (float)x;
+        cells.push_back({ x, piece*(1.0f - right) });
+        cells.push_back({ x + 1, piece*right });
+        start = end;
+    }
+}
+
+void Pixie::FillPolygonAA(const DrawTarget& target, const DrawPoint* points, int count, uint32_t colour)
+{
+    if (count < 3 || target.clipX0 >= target.clipX1)
+        return;
+
+    struct AAEdge
+    {
+        DrawPoint top, bottom;
+        float slope;
+        float winding;
+        int firstRow, endRow;
+    };
+
+    // Kept between calls so filling doesn't allocate once they've grown.
+    static thread_local std::vector<AAEdge> edges;
+    static thread_local std::vector<int> active;
+    static thread_local std::vector<CoverageCell> cells;
+    static thread_local std::vector<uint16_t> alphas;
+    edges.clear();
+    active.clear();
+
+    for (int i = 0; i < count; i++)
+    {
+        DrawPoint a = points[i];
+        DrawPoint b = points[i + 1 < count ? i + 1 : 0];
+        if (a.y == b.y)
+            continue;
+
+        AAEdge edge;
+        edge.winding = a.y < b.y ? 1.0f : -1.0f;
+        edge.top = a.y < b.y ? a : b;
+        edge.bottom = a.y < b.y ? b : a;
+        edge.slope = (edge.bottom.x - edge.top.x) / (edge.bottom.y - edge.top.y);
+        edge.firstRow = (int)std::max(floorf(edge.top.y), (float)target.clipY0);
+        edge.endRow = (int)std::min(ceilf(edge.bottom.y), (float)target.clipY1);
+        if (edge.firstRow < edge.endRow)
+            edges.push_back(edge);
+    }
+    if (edges.empty())
+        return;
+
+    std::sort(edges.begin(), edges.end(), [](const AAEdge& a, const AAEdge& b) { return a.firstRow < b.firstRow; });
+    int endRow = 0;
+    for (size_t i = 0; i < edges.size(); i++)
+        endRow = std::max(endRow, edges[i].endRow);
+
+    size_t next = 0;
+    uint32_t* row = target.pixels + edges[0].firstRow*target.pitch;
+    for (int y = edges[0].firstRow; y < endRow; y++, row += target.pitch)
+    {
+        for ( ; next < edges.size() && edges[next].firstRow == y; next++)
+            active.push_back((int)next);
+        active.erase(std::remove_if(active.begin(), active.end(), [y](int i) { return edges[i].endRow <= y; }), active.end());
+
+        // Gather the cells of every edge crossing the row.
+        cells.clear();
+        for (size_t i = 0; i < active.size(); i++)
+        {
+            const AAEdge& edge = edges[active[i]];
+            float yA = std::max(edge.top.y, (float)y);
+            float yB = std::min(edge.bottom.y, (float)(y + 1));
+            if (yB <= yA)
+                continue;
+            float xA = edge.top.x + (yA - edge.top.y)*edge.slope;
+            float xB = edge.top.x + (yB - edge.top.y)*edge.slope;
+            AddEdgeCells(cells, xA, xB, (yB - yA)*edge.winding, target.clipX0, target.clipX1);
+        }
+        std::sort(cells.begin(), cells.end(), [](const CoverageCell& a, const CoverageCell& b) { return a.x < b.x; });
+
+        // The coverage is the same from one cell up to the next. Short runs, mostly single edge
+        // pixels, are gathered up and blended together; longer ones are filled, blended or skipped.
+        float coverage = 0;
+        int alphaX = 0;
+        alphas.clear();
+        for (size_t i = 0; i < cells.size(); )
+        {
+            int x = cells[i].x;
+            for ( ; i < cells.size() && cells[i].x == x; i++)
+                coverage += cells[i].cover;
+            if (x >= target.clipX1)
+                break;
+
+            int end = i < cells.size() ? std::min(cells[i].x, target.clipX1) : target.clipX1;
+            uint32_t alpha = CoverageToAlpha(coverage);
+            if (end - x < 4 && (alphas.empty() || alphaX + (int)alphas.size() == x))
+            {
+                if (alphas.empty())
+                    alphaX = x;
+                alphas.insert(alphas.end(), end - x, (uint16_t)alpha);
+                continue;
+            }
+
+            if (!alphas.empty())
+            {
+                BlendSpanAlpha(row + alphaX, &alphas[0], (int)alphas.size(), colour);
+                alphas.clear();
+            }
+
+            if (end - x < 4)
+            {
+                alphaX = x;
+                alphas.insert(alphas.end(), end - x, (uint16_t)alpha);
+            }
+            else if (alpha == 256)
+            {
+                FillSpan(row + x, end - x, colour);
+            }
+            else if (alpha != 0)
+            {
+                BlendSpan(row + x, end - x, colour, alpha);
+            }
+        }
+        if (!alphas.empty())
+            BlendSpanAlpha(row + alphaX, &alphas[0], (int)alphas.size(), colour);
+    }
+}
+
+void Pixie::Blit(const DrawTarget& target, const DrawTarget& source, int x, int y, BlitMode mode, uint32_t colourKey /*= 0*/)
+{
+    int left = std::max(x, target.clipX0);
+    int top = std::max(y, target.clipY0);
+    int right = std::min(x + source.clipX1 - source.clipX0, target.clipX1);
+    int bottom = std::min(y + source.clipY1 - source.clipY0, target.clipY1);
+    if (left >= right || top >= bottom)
+        return;
+
+    int width = right - left;
+    const uint32_t* src = source.pixels + (source.clipY0 + top - y)*source.pitch + source.clipX0 + left - x;
+    uint32_t* dst = target.pixels + top*target.pitch + left;
+    for (int row = top; row < bottom; row++, src += source.pitch, dst += target.pitch)
+    {
+        switch (mode)
+        {
+            case BlitMode_Copy:
+                memcpy(dst, src, width*sizeof(uint32_t));
+                break;
+            case BlitMode_ColourKey:
+                CopySpanKeyed(dst, src, width, colourKey);
+                break;
+            case BlitMode_Alpha:
+                BlendSpanPremultiplied(dst, src, width);
+                break;
+            case BlitMode_Add:
+                AddSpan(dst, src, width);
+                break;
+        }
+    }
+}
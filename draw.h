@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace Pixie
+{
+    enum BlitMode
+    {
+        // Copies the source pixels as they are.
+        BlitMode_Copy = 0,
+        // Copies the source pixels except those matching the colour key, ignoring alpha.
+        BlitMode_ColourKey,
+        // Draws the source over the target using its alpha, with the source colours already
+        // multiplied by it (see PremultiplyAlpha in span.h).
+        BlitMode_Alpha,
+        // Adds the source to the target, clamping each channel at 255.
+        BlitMode_Add
+    };
+
+    // Pixels to draw into, e.g. a Window's backing buffer or a Buffer's data. Rows are pitch
+    // pixels apart and nothing is drawn outside the clip rect, from (clipX0, clipY0) inclusive to
+    // (clipX1, clipY1) exclusive, which starts out as the whole width x height.
+    struct DrawTarget
+    {
+        DrawTarget(uint32_t* pixels, int width, int height);
+        DrawTarget(uint32_t* pixels, int width, int height, int pitch);
+
+        // Narrows the clip rect to the given rect, which is itself clipped to the pixels.
+        void SetClip(int x, int y, int width, int height);
+
+        uint32_t* pixels;
+        int width, height;
+        int pitch;
+        int clipX0, clipY0;
+        int clipX1, clipY1;
+    };
+
+    // A point for the filled shapes, which can fall between pixels.
+    struct DrawPoint
+    {
+        float x, y;
+    };
+
+    // Draws a one pixel wide line from (x0, y0) to (x1, y1), both ends included. Lines are
+    // stepped with Bresenham's algorithm from the first clipped pixel, so long lines running
+    // mostly off the target cost little.
+    void DrawLine(const DrawTarget& target, int x0, int y0, int x1, int y1, uint32_t colour);
+
+    // Draws the outline of a circle using the midpoint algorithm, or fills it a row at a time.
+    void DrawCircle(const DrawTarget& target, int centreX, int centreY, int radius, uint32_t colour);
+    void FillCircle(const DrawTarget& target, int centreX, int centreY, int radius, uint32_t colour);
+
+    // Fills the pixels whose centres are inside the shape, a span per row. A centre exactly on an
+    // edge is inside for left and top edges only, so shapes sharing an edge meet with no gap and
+    // no pixel drawn twice. Polygons may be concave or cross themselves and are filled using the
+    // non-zero winding rule.
+    void FillTriangle(const DrawTarget& target, DrawPoint p0, DrawPoint p1, DrawPoint p2, uint32_t colour);
+    void FillPolygon(const DrawTarget& target, const DrawPoint* points, int count, uint32_t colour);
+
+    // Draws a one pixel wide anti-aliased line between two points, which can fall between pixels.
+    // As in Wu's algorithm each step along the line blends the two pixels nearest it, weighted by
+    // how close it passes and by how much of the step the line covers, so lines drawn end to end
+    // join without a bright or dark spot.
+    void DrawLineAA(const DrawTarget& target, DrawPoint p0, DrawPoint p1, uint32_t colour);
+
+    // Fills a polygon with anti-aliased edges, blending each pixel by the area of it the polygon
+    // covers, using the non-zero winding rule. Each row only keeps the cells its edges pass
+    // through, so the pixels between edges are filled, blended or skipped a span at a time.
+    void FillPolygonAA(const DrawTarget& target, const DrawPoint* points, int count, uint32_t colour);
+
+    // Draws the part of source inside its clip rect onto target, with the clip rect's top left
+    // corner at (x, y). Rows are composited 8 pixels at a time with AVX2 or SSE2.
+    void Blit(const DrawTarget& target, const DrawTarget& source, int x, int y, BlitMode mode, uint32_t colourKey = 0);
+}
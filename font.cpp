@@ -3,12 +3,12 @@
 #include <stdlib.h>
 #include "font.h"
 #include "pixie.h"
-#include "fontbmp.h"
-#if !PIXIE_PLATFORM_WIN
+#include "fontbaked.h"
+#include "span.h"
 #include <string.h>
-#endif
+#include <algorithm>
 
-#if PIXIE_PLATFORM_OSX
+#if !PIXIE_PLATFORM_WIN
 struct BITMAPFILEHEADER
 {
     uint16_t	bfType;
@@ -41,268 +41,251 @@ using namespace Pixie;
 Font::~Font()
 {
     delete[] m_fontBuffer;
+    delete[] m_glyphRows;
 }
 
 bool Font::Load(const char* filename, int characterSizeX, int characterSizeY)
 {
-    m_characterSizeX = characterSizeX;
-    m_characterSizeY = characterSizeY;
-
     FILE* infile = fopen(filename, "rb");
     if (!infile)
         return false;
 
-    BITMAPFILEHEADER bmfh;
-    fread(&bmfh, sizeof(bmfh), 1, infile);
-    if (bmfh.bfType != 0x4d42) // 'MB'
-    {
-        fclose(infile);
-        return false;
-    }
-
-    BITMAPINFOHEADER bmih;
-    fread(&bmih, sizeof(bmih), 1, infile);
-    if (bmih.biSize != sizeof(bmih))
-    {
-        fclose(infile);
-        return false;
-    }
-
-    if ((bmih.biBitCount != 32 && bmih.biBitCount != 24) || bmih.biCompression != BI_RGB)
+    fseek(infile, 0, SEEK_END);
+    long size = ftell(infile);
+    fseek(infile, 0, SEEK_SET);
+    if (size <= 0)
     {
         fclose(infile);
         return false;
     }
 
-    fseek(infile, bmfh.bfOffBits, SEEK_SET);
+    uint8_t* data = new uint8_t[size];
+    bool result = fread(data, 1, size, infile) == (size_t)size && LoadFromMemory(data, size, characterSizeX, characterSizeY);
 
-    m_width = bmih.biWidth;
-    m_height = abs(bmih.biHeight);
-
-    uint32_t size = 256 * m_characterSizeX * m_characterSizeY;
-    m_fontBuffer = new uint32_t[size];
+    fclose(infile);
+    delete[] data;
 
-    if (bmih.biBitCount == 32)
-    {
-        fread(m_fontBuffer, 1, size * 4, infile);
-    }
-    else if (bmih.biBitCount == 24)
-    {
-        // read into 24bit buf and expand
-        uint8_t* buf24 = new uint8_t[size * 3];
-        fread(buf24, 1, size * 3, infile);
+    return result;
+}
 
-        uint8_t* pcurr = buf24;
-        for (uint32_t i = 0; i < size; ++i)
-        {
-            // from: R,G,B
-            // to:   xRGB
-            m_fontBuffer[i] =
-                0xff000000 |
-                (*(pcurr) << 16) |
-                (*(pcurr + 1) << 8) |
-                (*(pcurr + 2));
-
-            pcurr += 3;
-        }
+bool Font::LoadDefaultFont()
+{
+    // The default font was baked into packed glyph scanlines at build time (see fontbake.cpp),
+    // so there's no bitmap to parse, just bits to unpack into the masks.
+    m_characterSizeX = BakedFont::CharacterSizeX;
+    m_characterSizeY = BakedFont::CharacterSizeY;
+    m_width = 256 * BakedFont::CharacterSizeX;
+    m_height = BakedFont::CharacterSizeY;
+    m_glyphColour = BakedFont::Colour;
+    m_monochrome = true;
+
+    // Monochrome fonts draw from the masks only, so there's no atlas.
+    delete[] m_fontBuffer;
+    m_fontBuffer = 0;
 
-        delete[] buf24;
-    }
+    delete[] m_glyphRows;
+    m_glyphRows = new uint32_t[256 * BakedFont::CharacterSizeY];
 
-    // if we don't have a negative height, the bmp is stored upside-down, so go through and flip it
-    if (bmih.biHeight > 0)
+    size_t bit = 0;
+    for (int i = 0; i < 256 * BakedFont::CharacterSizeY; i++)
     {
-        uint32_t* rowbuf = new uint32_t[m_width];
-        // flip all rows apart from the middle one if the image has an odd height
-        // h = 4; h/2 = 2; y 0,fy 3 | y 1,fy 2
-        // h = 5; h/2 = 2; y 0,fy 4 | y 1,fy 3  [row 2 unchanged]
-        for (uint32_t y = 0; y < m_height / 2; ++y)
-        {
-            uint32_t flipy = (m_height - (y + 1));
-
-            void* row = m_fontBuffer + (m_width * y);
-            void* fliprow = m_fontBuffer + (m_width * flipy);
-            uint32_t rowsize = m_width * sizeof(uint32_t);
-
-            // 1. copy fliprow into rowbuf
-            memcpy(rowbuf, fliprow, rowsize);
-
-            // 2. copy row into fliprow
-            memcpy(fliprow, row, rowsize);
-
-            // 3. copy rowbuf into row
-            memcpy(row, rowbuf, rowsize);
-        }
-
-        delete[] rowbuf;
+        uint32_t mask = 0;
+        for (int cx = 0; cx < BakedFont::CharacterSizeX; cx++, bit++)
+            mask |= ((BakedFont::Bits[bit >> 3] >> (bit & 7)) & 1u) << cx;
+        m_glyphRows[i] = mask;
     }
 
-    fclose(infile);
-
     return true;
 }
 
-bool Font::LoadDefaultFont()
+bool Font::LoadFromMemory(const void* data, size_t size, int characterSizeX, int characterSizeY)
 {
-    m_characterSizeX = 9;
-    m_characterSizeY = 16;
+    if (characterSizeX <= 0 || characterSizeX > 32 || characterSizeY <= 0)
+        return false;
 
-    FILE* infile = tmpfile();
-    if (!infile)
+    const uint8_t* bytes = (const uint8_t*)data;
+    if (size < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER))
         return false;
-    fwrite(font_bmp, sizeof(char), font_bmp_len, infile);
-    rewind(infile);
 
+    // Copy the headers out rather than casting, the data may not be aligned.
     BITMAPFILEHEADER bmfh;
-    fread(&bmfh, sizeof(bmfh), 1, infile);
+    memcpy(&bmfh, bytes, sizeof(bmfh));
     if (bmfh.bfType != 0x4d42) // 'MB'
-    {
-        fclose(infile);
         return false;
-    }
 
     BITMAPINFOHEADER bmih;
-    fread(&bmih, sizeof(bmih), 1, infile);
+    memcpy(&bmih, bytes + sizeof(bmfh), sizeof(bmih));
     if (bmih.biSize != sizeof(bmih))
-    {
-        fclose(infile);
         return false;
-    }
 
     if ((bmih.biBitCount != 32 && bmih.biBitCount != 24) || bmih.biCompression != BI_RGB)
-    {
-        fclose(infile);
         return false;
-    }
 
-    fseek(infile, bmfh.bfOffBits, SEEK_SET);
+    // The bitmap needs to hold all 256 characters on one line.
+    uint32_t width = bmih.biWidth;
+    uint32_t height = abs(bmih.biHeight);
+    uint32_t atlasWidth = 256 * characterSizeX;
+    if (bmih.biWidth <= 0 || width < atlasWidth || height < (uint32_t)characterSizeY)
+        return false;
 
-    m_width = bmih.biWidth;
-    m_height = abs(bmih.biHeight);
+    // Rows are padded to 4 bytes, which only matters for 24 bit bitmaps.
+    uint32_t bytesPerPixel = bmih.biBitCount / 8;
+    size_t stride = ((width * bytesPerPixel) + 3) & ~3;
+    if (bmfh.bfOffBits > size || (size - bmfh.bfOffBits) / stride < height)
+        return false;
 
-    uint32_t size = 256 * m_characterSizeX * m_characterSizeY;
-    m_fontBuffer = new uint32_t[size];
+    m_characterSizeX = characterSizeX;
+    m_characterSizeY = characterSizeY;
+    m_width = atlasWidth;
+    m_height = characterSizeY;
 
-    if (bmih.biBitCount == 32)
-    {
-        fread(m_fontBuffer, 1, size * 4, infile);
-    }
-    else if (bmih.biBitCount == 24)
+    delete[] m_fontBuffer;
+    m_fontBuffer = new uint32_t[atlasWidth * characterSizeY];
+
+    const uint8_t* pixelData = bytes + bmfh.bfOffBits;
+    for (int y = 0; y < characterSizeY; y++)
     {
-        // read into 24bit buf and expand
-        uint8_t* buf24 = new uint8_t[size * 3];
-        fread(buf24, 1, size * 3, infile);
+        // If we don't have a negative height, the bmp is stored upside-down.
+        uint32_t sourceY = bmih.biHeight > 0 ? height - 1 - y : y;
+        const uint8_t* src = pixelData + (sourceY * stride);
+        uint32_t* dst = m_fontBuffer + (y * atlasWidth);
 
-        uint8_t* pcurr = buf24;
-        for (uint32_t i = 0; i < size; ++i)
+        if (bmih.biBitCount == 32)
         {
-            // from: R,G,B
-            // to:   xRGB
-            m_fontBuffer[i] =
-                0xff000000 |
-                (*(pcurr) << 16) |
-                (*(pcurr + 1) << 8) |
-                (*(pcurr + 2));
-
-            pcurr += 3;
+            memcpy(dst, src, atlasWidth * sizeof(uint32_t));
         }
-
-        delete[] buf24;
-    }
-
-    // if we don't have a negative height, the bmp is stored upside-down, so go through and flip it
-    if (bmih.biHeight > 0)
-    {
-        uint32_t* rowbuf = new uint32_t[m_width];
-        // flip all rows apart from the middle one if the image has an odd height
-        // h = 4; h/2 = 2; y 0,fy 3 | y 1,fy 2
-        // h = 5; h/2 = 2; y 0,fy 4 | y 1,fy 3  [row 2 unchanged]
-        for (uint32_t y = 0; y < m_height / 2; ++y)
+        else
         {
-            uint32_t flipy = (m_height - (y + 1));
-
-            void* row = m_fontBuffer + (m_width * y);
-            void* fliprow = m_fontBuffer + (m_width * flipy);
-            uint32_t rowsize = m_width * sizeof(uint32_t);
-
-            // 1. copy fliprow into rowbuf
-            memcpy(rowbuf, fliprow, rowsize);
-
-            // 2. copy row into fliprow
-            memcpy(fliprow, row, rowsize);
-
-            // 3. copy rowbuf into row
-            memcpy(row, rowbuf, rowsize);
+            for (uint32_t x = 0; x < atlasWidth; x++, src += 3)
+            {
+                // from: B,G,R
+                // to:   xRGB
+                dst[x] = 0xff000000 | (src[2] << 16) | (src[1] << 8) | src[0];
+            }
         }
-
-        delete[] rowbuf;
     }
 
-    fclose(infile);
+    BuildGlyphMasks();
 
     return true;
 }
 
-void Font::Draw(const char* msg, int x, int y, Pixie::Window* window)
+void Font::BuildGlyphMasks()
 {
-    uint32_t* pixels = window->GetPixels();
-    int width = window->GetWidth();
-    int height = window->GetHeight();
+    delete[] m_glyphRows;
+    m_glyphRows = new uint32_t[256 * m_characterSizeY];
 
-    for ( ; *msg; msg++)
-    {
-        uint8_t c = *msg;
-        uint32_t* charStart = m_fontBuffer + (c * m_characterSizeX);
+    // Note whether every set pixel is the same colour, in which case Draw doesn't need the atlas.
+    bool foundColour = false;
+    m_monochrome = true;
 
-        for (int cx = 0; cx < m_characterSizeX; cx++)
+    for (int c = 0; c < 256; c++)
+    {
+        const uint32_t* charStart = m_fontBuffer + (c * m_characterSizeX);
+        for (int cy = 0; cy < m_characterSizeY; cy++)
         {
-            for (int cy = 0; cy < m_characterSizeY; cy++)
+            const uint32_t* row = charStart + (cy * 256 * m_characterSizeX);
+            uint32_t mask = 0;
+            for (int cx = 0; cx < m_characterSizeX; cx++)
             {
-                int sx = cx + x;
-                int sy = cy + y;
-                if (sx >= 0 && sx < width && sy >= 0 && sy < height)
+                uint32_t pixel = row[cx];
+                if (!(pixel & 0xffffff))
+                    continue;
+
+                mask |= 1u << cx;
+                if (!foundColour)
+                {
+                    m_glyphColour = pixel;
+                    foundColour = true;
+                }
+                else if (pixel != m_glyphColour)
                 {
-                    uint32_t pixel = charStart[cx + (cy * 256 * m_characterSizeX)];
-                    if (pixel & 0xffffff)
-                        pixels[sx+(sy*width)] = pixel;
+                    m_monochrome = false;
                 }
             }
-        }
 
-        x += m_characterSizeX;
+            m_glyphRows[(c * m_characterSizeY) + cy] = mask;
+        }
     }
 }
 
-void Font::DrawColour(const char* msg, int x, int y, uint32_t colour, Pixie::Window* window)
+void Font::DrawGlyphs(const char* msg, int x, int y, uint32_t colour, const uint32_t* atlas, uint32_t* pixels, int pitch, int clipX0, int clipY0, int clipX1, int clipY1) const
 {
-    uint32_t* pixels = window->GetPixels();
-    int width = window->GetWidth();
-    int height = window->GetHeight();
+    int length = (int)strlen(msg);
 
-    for (; *msg; msg++)
-    {
-        uint8_t c = *msg;
-        uint32_t* charStart = m_fontBuffer + (c * m_characterSizeX);
+    // Clip the scanlines and the run of characters once for the whole string.
+    int cy0 = std::max(clipY0 - y, 0);
+    int cy1 = std::min(clipY1 - y, (int)m_characterSizeY);
+    int first = x < clipX0 ? (clipX0 - x) / m_characterSizeX : 0;
+    int last = std::min(length, (clipX1 - x + m_characterSizeX - 1) / m_characterSizeX);
+    if (cy0 >= cy1 || first >= last)
+        return;
 
-        for (int cx = 0; cx < m_characterSizeX; cx++)
+    for (int cy = cy0; cy < cy1; cy++)
+    {
+        uint32_t* row = pixels + ((y + cy) * pitch);
+        int sx = x + (first * m_characterSizeX);
+        for (int i = first; i < last; i++, sx += m_characterSizeX)
         {
-            for (int cy = 0; cy < m_characterSizeY; cy++)
+            uint8_t c = msg[i];
+            uint32_t mask = m_glyphRows[(c * m_characterSizeY) + cy];
+
+            // Drop the columns that fall outside the clip rectangle.
+            int cx0 = 0;
+            if (sx < clipX0)
             {
-                int sx = cx + x;
-                int sy = cy + y;
-                if (sx >= 0 && sx < width && sy >= 0 && sy < height)
-                {
-                    uint32_t pixel = charStart[cx + (cy * 256 * m_characterSizeX)];
-                    if (pixel & 0xffffff)
-                        pixels[sx + (sy*width)] = colour;
-                }
+                cx0 = clipX0 - sx;
+                mask >>= cx0;
             }
-        }
+            if (sx + m_characterSizeX > clipX1)
+                mask &= (1u << (clipX1 - sx - cx0)) - 1;
+            if (!mask)
+                continue;
 
-        x += m_characterSizeX;
+            if (!atlas)
+            {
+                FillSpanMasked(row + sx + cx0, mask, colour);
+                continue;
+            }
+
+            const uint32_t* src = atlas + (c * m_characterSizeX) + (cy * 256 * m_characterSizeX) + cx0;
+            uint32_t* dst = row + sx + cx0;
+            for (int cx = 0; mask; mask >>= 1, cx++)
+            {
+                if (mask & 1)
+                    dst[cx] = src[cx];
+            }
+        }
     }
 }
 
+void Font::Draw(const char* msg, int x, int y, Pixie::Window* window)
+{
+    // Single colour fonts (like the default one) are drawn straight from the masks, others need
+    // their colours from the atlas.
+    window->Invalidate(x, y, GetStringWidth(msg), m_characterSizeY);
+    if (m_monochrome)
+        DrawGlyphs(msg, x, y, m_glyphColour, 0, window->GetPixels(), window->GetWidth(), 0, 0, window->GetWidth(), window->GetHeight());
+    else
+        DrawGlyphs(msg, x, y, 0, m_fontBuffer, window->GetPixels(), window->GetWidth(), 0, 0, window->GetWidth(), window->GetHeight());
+}
+
+void Font::DrawColour(const char* msg, int x, int y, uint32_t colour, Pixie::Window* window)
+{
+    window->Invalidate(x, y, GetStringWidth(msg), m_characterSizeY);
+    DrawGlyphs(msg, x, y, colour, 0, window->GetPixels(), window->GetWidth(), 0, 0, window->GetWidth(), window->GetHeight());
+}
+
+void Font::DrawColour(const char* msg, int x, int y, uint32_t colour, uint32_t* pixels, int width, int height) const
+{
+    DrawGlyphs(msg, x, y, colour, 0, pixels, width, 0, 0, width, height);
+}
+
+void Font::DrawColour(const char* msg, int x, int y, uint32_t colour, uint32_t* pixels, int pitch, int clipX0, int clipY0, int clipX1, int clipY1) const
+{
+    DrawGlyphs(msg, x, y, colour, 0, pixels, pitch, clipX0, clipY0, clipX1, clipY1);
+}
+
 int Font::GetStringWidth(const char* msg) const
 {
     return (int)strlen(msg) * m_characterSizeX;
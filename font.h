@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include "core.h"
 
@@ -8,6 +9,7 @@ namespace Pixie
     class Window;
 
     // BMP font loader. Expects the entire character set (256 ASCII characters) on one line.
+    // Characters can be at most 32 pixels wide.
     class Font
     {
         public:
@@ -16,15 +18,26 @@ namespace Pixie
 
             // Loads the font in the given BMP filename using the specified character size.
             bool Load(const char* filename, int characterSizeX, int characterSizeY);
-            // Loads the default font from memory using the hard coded array
+            // Loads the default font, which is baked from font.bmp into a packed table at build time.
             bool LoadDefaultFont();
 
+            // Loads the font from a BMP file image held in memory.
+            bool LoadFromMemory(const void* data, size_t size, int characterSizeX, int characterSizeY);
+
             // Draws the specified font to the window in the font colour.
             void Draw(const char* msg, int x, int y, Pixie::Window* window);
 
             // Draws the specified font to the window in the given colour.
             void DrawColour(const char* msg, int x, int y, uint32_t colour, Pixie::Window* window);
 
+            // Draws the specified font in the given colour to a width x height buffer of pixels, e.g. an
+            // offscreen target. Doesn't change the font, so several threads can draw with it at once.
+            void DrawColour(const char* msg, int x, int y, uint32_t colour, uint32_t* pixels, int width, int height) const;
+
+            // As above, but only touches the pixels in [clipX0, clipX1) x [clipY0, clipY1), which must
+            // lie within the buffer. Pitch is the buffer width.
+            void DrawColour(const char* msg, int x, int y, uint32_t colour, uint32_t* pixels, int pitch, int clipX0, int clipY0, int clipX1, int clipY1) const;
+
             // Returns the width of the specified string in this font.
             int GetStringWidth(const char* msg) const;
 
@@ -35,7 +48,14 @@ namespace Pixie
             int GetCharacterWidth() const;
 
         private:
+            // Packs each glyph scanline into a bit mask (bit n is column n) for drawing.
+            void BuildGlyphMasks();
+            void DrawGlyphs(const char* msg, int x, int y, uint32_t colour, const uint32_t* atlas, uint32_t* pixels, int pitch, int clipX0, int clipY0, int clipX1, int clipY1) const;
+
             uint32_t* m_fontBuffer;
+            uint32_t* m_glyphRows;
+            uint32_t m_glyphColour;
+            bool m_monochrome;
             uint32_t m_width;
             uint32_t m_height;
             uint8_t m_characterSizeX;
@@ -45,6 +65,9 @@ namespace Pixie
     inline Font::Font()
     {
         m_fontBuffer = 0;
+        m_glyphRows = 0;
+        m_glyphColour = 0;
+        m_monochrome = false;
         m_width = m_height = 0;
     }
 
@@ -0,0 +1,148 @@
+// Build tool: converts a BMP font (256 characters on one line, as Font::Load expects) into a
+// header with the glyphs packed one bit per pixel, which Font::LoadDefaultFont uses directly.
+//
+//     pixie_fontbake font.bmp fontbaked.h 9 16
+//
+// Glyph scanlines are stored back to back in character order, characterSizeX bits each, with
+// column 0 in the lowest bit.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t ReadU32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t ReadU16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 5)
+    {
+        fprintf(stderr, "usage: %s <font.bmp> <output.h> <characterSizeX> <characterSizeY>\n", argv[0]);
+        return 1;
+    }
+
+    const char* inputPath = argv[1];
+    const char* outputPath = argv[2];
+    int characterSizeX = atoi(argv[3]);
+    int characterSizeY = atoi(argv[4]);
+    if (characterSizeX <= 0 || characterSizeX > 32 || characterSizeY <= 0)
+    {
+        fprintf(stderr, "fontbake: invalid character size %dx%d\n", characterSizeX, characterSizeY);
+        return 1;
+    }
+
+    FILE* infile = fopen(inputPath, "rb");
+    if (!infile)
+    {
+        fprintf(stderr, "fontbake: can't open %s\n", inputPath);
+        return 1;
+    }
+
+    fseek(infile, 0, SEEK_END);
+    long size = ftell(infile);
+    fseek(infile, 0, SEEK_SET);
+    uint8_t* data = (uint8_t*)malloc(size > 0 ? size : 1);
+    bool readOk = size > 54 && fread(data, 1, size, infile) == (size_t)size;
+    fclose(infile);
+
+    // BITMAPFILEHEADER is 14 bytes, followed by a 40 byte BITMAPINFOHEADER.
+    if (!readOk || ReadU16(data) != 0x4d42 || ReadU32(data + 14) != 40)
+    {
+        fprintf(stderr, "fontbake: %s is not a BMP file\n", inputPath);
+        return 1;
+    }
+
+    uint32_t dataOffset = ReadU32(data + 10);
+    int32_t width = (int32_t)ReadU32(data + 18);
+    int32_t height = (int32_t)ReadU32(data + 22);
+    uint16_t bitCount = ReadU16(data + 28);
+    uint32_t compression = ReadU32(data + 30);
+    uint32_t absHeight = height < 0 ? -height : height;
+
+    if ((bitCount != 32 && bitCount != 24) || compression != 0)
+    {
+        fprintf(stderr, "fontbake: %s must be an uncompressed 24 or 32 bit BMP\n", inputPath);
+        return 1;
+    }
+
+    int atlasWidth = 256 * characterSizeX;
+    uint32_t bytesPerPixel = bitCount / 8;
+    size_t stride = ((width * bytesPerPixel) + 3) & ~3;
+    if (width < atlasWidth || absHeight < (uint32_t)characterSizeY || dataOffset + stride * absHeight > (size_t)size)
+    {
+        fprintf(stderr, "fontbake: %s is too small for 256 %dx%d characters\n", inputPath, characterSizeX, characterSizeY);
+        return 1;
+    }
+
+    size_t numBits = (size_t)256 * characterSizeY * characterSizeX;
+    size_t numBytes = (numBits + 7) / 8;
+    uint8_t* bits = (uint8_t*)calloc(numBytes, 1);
+
+    // Every set pixel has to be the same colour, the baked font only keeps one.
+    uint32_t colour = 0;
+    bool foundColour = false;
+
+    size_t bit = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        for (int y = 0; y < characterSizeY; y++)
+        {
+            // If we don't have a negative height, the bmp is stored upside-down.
+            uint32_t sourceY = height > 0 ? absHeight - 1 - y : y;
+            const uint8_t* row = data + dataOffset + (sourceY * stride);
+
+            for (int x = 0; x < characterSizeX; x++, bit++)
+            {
+                const uint8_t* p = row + ((c * characterSizeX) + x) * bytesPerPixel;
+                uint32_t pixel = bitCount == 32 ? ReadU32(p) : 0xff000000 | (p[2] << 16) | (p[1] << 8) | p[0];
+                if (!(pixel & 0xffffff))
+                    continue;
+
+                if (foundColour && pixel != colour)
+                {
+                    fprintf(stderr, "fontbake: %s has more than one glyph colour\n", inputPath);
+                    return 1;
+                }
+
+                colour = pixel;
+                foundColour = true;
+                bits[bit >> 3] |= 1 << (bit & 7);
+            }
+        }
+    }
+
+    FILE* outfile = fopen(outputPath, "w");
+    if (!outfile)
+    {
+        fprintf(stderr, "fontbake: can't write %s\n", outputPath);
+        return 1;
+    }
+
+    fprintf(outfile, "// Generated by pixie_fontbake from %s. Do not edit.\n", inputPath);
+    fprintf(outfile, "#pragma once\n\n");
+    fprintf(outfile, "#include <stdint.h>\n\n");
+    fprintf(outfile, "namespace Pixie\n{\n");
+    fprintf(outfile, "    namespace BakedFont\n    {\n");
+    fprintf(outfile, "        constexpr int CharacterSizeX = %d;\n", characterSizeX);
+    fprintf(outfile, "        constexpr int CharacterSizeY = %d;\n", characterSizeY);
+    fprintf(outfile, "        constexpr uint32_t Colour = 0x%08x;\n", colour);
+    fprintf(outfile, "        constexpr uint8_t Bits[%u] =\n        {", (unsigned)numBytes);
+    for (size_t i = 0; i < numBytes; i++)
+        fprintf(outfile, "%s0x%02x,", (i % 16) == 0 ? "\n            " : " ", bits[i]);
+    fprintf(outfile, "\n        };\n");
+    fprintf(outfile, "    }\n}\n");
+    fclose(outfile);
+
+    free(bits);
+    free(data);
+
+    return 0;
+}
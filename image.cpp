@@ -0,0 +1,723 @@
+#include "image.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using namespace Pixie;
+
+// Encoded output is handed to fwrite (and split into PNG chunks) in blocks of about this size.
+static const size_t OutputBlockSize = 64 * 1024;
+
+namespace
+{
+    class FileWriter
+    {
+        public:
+            FileWriter(const char* filename)
+            {
+                m_file = fopen(filename, "wb");
+                m_failed = !m_file;
+            }
+
+            ~FileWriter()
+            {
+                if (m_file)
+                    fclose(m_file);
+            }
+
+            bool IsOpen() const
+            {
+                return m_file != 0;
+            }
+
+            void Write(const void* data, size_t length)
+            {
+                if (!m_failed && length > 0 && fwrite(data, 1, length, m_file) != length)
+                    m_failed = true;
+            }
+
+            bool Close()
+            {
+                if (m_file && fclose(m_file) != 0)
+                    m_failed = true;
+                m_file = 0;
+                return !m_failed;
+            }
+
+        private:
+            FILE* m_file;
+            bool m_failed;
+    };
+
+    void PutU32BE(uint8_t* p, uint32_t value)
+    {
+        p[0] = (uint8_t)(value >> 24);
+        p[1] = (uint8_t)(value >> 16);
+        p[2] = (uint8_t)(value >> 8);
+        p[3] = (uint8_t)value;
+    }
+
+    uint32_t UpdateCrc32(uint32_t crc, const uint8_t* data, size_t length)
+    {
+        static const struct Table
+        {
+            uint32_t entries[256];
+            Table()
+            {
+                for (uint32_t i = 0; i < 256; i++)
+                {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++)
+                        c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                    entries[i] = c;
+                }
+            }
+        } table;
+
+        crc = ~crc;
+        for (size_t i = 0; i < length; i++)
+            crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    uint32_t UpdateAdler32(uint32_t adler, const uint8_t* data, size_t length)
+    {
+        uint32_t a = adler & 0xffff;
+        uint32_t b = adler >> 16;
+        while (length > 0)
+        {
+            // 5552 is the most bytes that can be summed before b can overflow 32 bits.
+            size_t n = std::min(length, (size_t)5552);
+            length -= n;
+            for ( ; n > 0; n--)
+            {
+                a += *data++;
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    // Deflate length and distance symbols (RFC 1951 3.2.5).
+    const uint16_t LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const uint8_t DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const uint8_t CodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    struct SymbolTables
+    {
+        uint8_t lengthCode[259];
+        // Distances up to 256 are looked up directly, longer ones by their top bits (as zlib does).
+        uint8_t distanceCode[512];
+
+        SymbolTables()
+        {
+            for (int code = 0; code < 29; code++)
+            {
+                int end = code == 28 ? 259 : LengthBase[code + 1];
+                for (int length = LengthBase[code]; length < end; length++)
+                    lengthCode[length] = (uint8_t)code;
+            }
+
+            for (int code = 0; code < 30; code++)
+            {
+                for (int d = DistanceBase[code] - 1; d < DistanceBase[code] - 1 + (1 << DistanceExtra[code]); d++)
+                {
+                    if (d < 256)
+                        distanceCode[d] = (uint8_t)code;
+                    else
+                        distanceCode[256 + (d >> 7)] = (uint8_t)code;
+                }
+            }
+        }
+
+        int DistanceCode(int distance) const
+        {
+            int d = distance - 1;
+            return d < 256 ? distanceCode[d] : distanceCode[256 + (d >> 7)];
+        }
+    };
+
+    const SymbolTables& GetSymbolTables()
+    {
+        static const SymbolTables tables;
+        return tables;
+    }
+
+    // Fills in Huffman code lengths for the given symbol frequencies. If the longest code would be
+    // over maxBits the frequencies are flattened and the tree rebuilt until it fits. At least two
+    // symbols always get a code, since inflaters reject incomplete code sets.
+    void BuildCodeLengths(const uint32_t* frequencies, int count, int maxBits, uint8_t* lengths)
+    {
+        uint32_t freq[286];
+        int symbols[286];
+        uint32_t weight[2 * 286];
+        int parent[2 * 286];
+        int depth[2 * 286];
+
+        memcpy(freq, frequencies, count * sizeof(uint32_t));
+        int used = 0;
+        for (int s = 0; s < count; s++)
+            used += freq[s] != 0;
+        for (int s = 0; s < count && used < 2; s++)
+        {
+            if (!freq[s])
+            {
+                freq[s] = 1;
+                used++;
+            }
+        }
+
+        for (;;)
+        {
+            int n = 0;
+            for (int s = 0; s < count; s++)
+            {
+                if (freq[s])
+                    symbols[n++] = s;
+            }
+            std::stable_sort(symbols, symbols + n, [&](int a, int b) { return freq[a] < freq[b]; });
+
+            // Two queue construction: the sorted leaves, then internal nodes, which are created in
+            // order of increasing weight.
+            for (int i = 0; i < n; i++)
+                weight[i] = freq[symbols[i]];
+            int leaf = 0;
+            int node = n;
+            for (int next = n; next < 2 * n - 1; next++)
+            {
+                int pair[2];
+                for (int k = 0; k < 2; k++)
+                {
+                    if (leaf < n && (node >= next || weight[leaf] <= weight[node]))
+                        pair[k] = leaf++;
+                    else
+                        pair[k] = node++;
+                }
+                weight[next] = weight[pair[0]] + weight[pair[1]];
+                parent[pair[0]] = next;
+                parent[pair[1]] = next;
+            }
+
+            int root = 2 * n - 2;
+            depth[root] = 0;
+            int longest = 0;
+            for (int i = root - 1; i >= 0; i--)
+            {
+                depth[i] = depth[parent[i]] + 1;
+                longest = std::max(longest, depth[i]);
+            }
+
+            if (longest <= maxBits)
+            {
+                memset(lengths, 0, count);
+                for (int i = 0; i < n; i++)
+                    lengths[symbols[i]] = (uint8_t)depth[i];
+                return;
+            }
+
+            for (int s = 0; s < count; s++)
+            {
+                if (freq[s])
+                    freq[s] = (freq[s] >> 1) | 1;
+            }
+        }
+    }
+
+    // Canonical codes for the given lengths, bit reversed because deflate writes them from the top bit.
+    void BuildCodes(const uint8_t* lengths, int count, uint16_t* codes)
+    {
+        int lengthCount[16] = {};
+        for (int s = 0; s < count; s++)
+            lengthCount[lengths[s]]++;
+        lengthCount[0] = 0;
+
+        int nextCode[16];
+        int code = 0;
+        for (int bits = 1; bits < 16; bits++)
+        {
+            code = (code + lengthCount[bits - 1]) << 1;
+            nextCode[bits] = code;
+        }
+
+        for (int s = 0; s < count; s++)
+        {
+            int length = lengths[s];
+            if (!length)
+                continue;
+
+            int c = nextCode[length]++;
+            int reversed = 0;
+            for (int i = 0; i < length; i++, c >>= 1)
+                reversed = (reversed << 1) | (c & 1);
+            codes[s] = (uint16_t)reversed;
+        }
+    }
+
+    // Writes a PNG's zlib stream as IDAT chunks. The data is compressed in blocks, each one with
+    // greedy LZ77 matching from a single entry hash table and its own Huffman codes. This is a
+    // lot faster than zlib's default level and still does well on UI and flat shaded images.
+    class PNGCompressor
+    {
+        public:
+            PNGCompressor(FileWriter* file);
+
+            // Compresses the next part of the image data.
+            void Write(const uint8_t* data, size_t length);
+            // Compresses whatever's left and finishes the zlib stream.
+            void Finish();
+
+        private:
+            enum
+            {
+                WindowSize = 32768,
+                BlockSize = 128 * 1024,
+                HashBits = 15,
+                MinMatch = 4,
+                MaxMatch = 258,
+                EndOfBlock = 256
+            };
+
+            void CompressBlock(bool final);
+            void WriteBlock(bool final, size_t numTokens);
+            void WriteChunk();
+
+            inline void WriteBits(uint32_t bits, int count)
+            {
+                m_bitBuffer |= (uint64_t)bits << m_bitCount;
+                m_bitCount += count;
+                if (m_bitCount >= 32)
+                {
+                    uint8_t bytes[4] = { (uint8_t)m_bitBuffer, (uint8_t)(m_bitBuffer >> 8), (uint8_t)(m_bitBuffer >> 16), (uint8_t)(m_bitBuffer >> 24) };
+                    m_output.insert(m_output.end(), bytes, bytes + 4);
+                    m_bitBuffer >>= 32;
+                    m_bitCount -= 32;
+                }
+            }
+
+            FileWriter* m_file;
+            std::vector<uint8_t> m_output;
+            uint64_t m_bitBuffer;
+            int m_bitCount;
+            uint32_t m_adler;
+
+            // The last WindowSize bytes already compressed, followed by the bytes waiting to be.
+            std::vector<uint8_t> m_input;
+            size_t m_inputStart;
+            size_t m_inputEnd;
+            // Stream position of m_input[0], the hash table holds stream positions.
+            uint32_t m_inputPosition;
+            std::vector<uint32_t> m_hash;
+
+            // A literal byte, or a match packed as (length << 16) | distance.
+            std::vector<uint32_t> m_tokens;
+            uint32_t m_literalFrequencies[286];
+            uint32_t m_distanceFrequencies[30];
+    };
+
+    PNGCompressor::PNGCompressor(FileWriter* file) : m_file(file), m_input(WindowSize + BlockSize), m_hash(1 << HashBits), m_tokens(BlockSize)
+    {
+        m_bitBuffer = 0;
+        m_bitCount = 0;
+        m_adler = 1;
+        m_inputStart = 0;
+        m_inputEnd = 0;
+        m_inputPosition = 0;
+        m_output.reserve(OutputBlockSize + BlockSize);
+
+        // zlib header: deflate with a 32K window, fastest compression level.
+        m_output.push_back(0x78);
+        m_output.push_back(0x01);
+    }
+
+    void PNGCompressor::Write(const uint8_t* data, size_t length)
+    {
+        m_adler = UpdateAdler32(m_adler, data, length);
+        while (length > 0)
+        {
+            size_t n = std::min(length, BlockSize - (m_inputEnd - m_inputStart));
+            memcpy(&m_input[m_inputEnd], data, n);
+            m_inputEnd += n;
+            data += n;
+            length -= n;
+
+            if (m_inputEnd - m_inputStart == BlockSize)
+                CompressBlock(false);
+        }
+    }
+
+    void PNGCompressor::Finish()
+    {
+        CompressBlock(true);
+
+        // Pad to a byte, then the Adler-32 of the uncompressed data.
+        while (m_bitCount > 0)
+        {
+            m_output.push_back((uint8_t)m_bitBuffer);
+            m_bitBuffer >>= 8;
+            m_bitCount = std::max(m_bitCount - 8, 0);
+        }
+        uint8_t adler[4];
+        PutU32BE(adler, m_adler);
+        m_output.insert(m_output.end(), adler, adler + 4);
+        WriteChunk();
+    }
+
+    void PNGCompressor::CompressBlock(bool final)
+    {
+        memset(m_literalFrequencies, 0, sizeof(m_literalFrequencies));
+        memset(m_distanceFrequencies, 0, sizeof(m_distanceFrequencies));
+
+        const SymbolTables& tables = GetSymbolTables();
+        const uint8_t* input = m_input.data();
+        size_t end = m_inputEnd;
+        size_t numTokens = 0;
+
+        for (size_t i = m_inputStart; i < end; )
+        {
+            if (i + MinMatch <= end)
+            {
+                uint32_t value;
+                memcpy(&value, input + i, sizeof(value));
+                uint32_t h = (value * 2654435761u) >> (32 - HashBits);
+                uint32_t position = m_inputPosition + (uint32_t)i;
+                uint32_t distance = position - m_hash[h];
+                m_hash[h] = position;
+
+                // The candidate has to still be in the window and in the buffer (stale entries
+                // from before the last slide point further back than i).
+                uint32_t candidateValue;
+                if (distance - 1 < WindowSize && distance <= i && (memcpy(&candidateValue, input + i - distance, sizeof(candidateValue)), candidateValue == value))
+                {
+                    const uint8_t* match = input + i - distance;
+                    size_t maxLength = std::min((size_t)MaxMatch, end - i);
+                    size_t length = MinMatch;
+                    while (length < maxLength && input[i + length] == match[length])
+                        length++;
+
+                    m_tokens[numTokens++] = (uint32_t)(length << 16) | distance;
+                    m_literalFrequencies[257 + tables.lengthCode[length]]++;
+                    m_distanceFrequencies[tables.DistanceCode(distance)]++;
+                    i += length;
+                    continue;
+                }
+            }
+
+            m_tokens[numTokens++] = input[i];
+            m_literalFrequencies[input[i]]++;
+            i++;
+        }
+        m_literalFrequencies[EndOfBlock]++;
+
+        WriteBlock(final, numTokens);
+
+        // Keep the last window's worth of data for the next block to match against.
+        if (m_inputEnd > WindowSize)
+        {
+            size_t shift = m_inputEnd - WindowSize;
+            memmove(&m_input[0], &m_input[shift], WindowSize);
+            m_inputPosition += (uint32_t)shift;
+            m_inputEnd = WindowSize;
+        }
+        m_inputStart = m_inputEnd;
+
+        if (m_output.size() >= OutputBlockSize)
+            WriteChunk();
+    }
+
+    void PNGCompressor::WriteBlock(bool final, size_t numTokens)
+    {
+        uint8_t literalLengths[286];
+        uint8_t distanceLengths[30];
+        uint16_t literalCodes[286];
+        uint16_t distanceCodes[30];
+        BuildCodeLengths(m_literalFrequencies, 286, 15, literalLengths);
+        BuildCodeLengths(m_distanceFrequencies, 30, 15, distanceLengths);
+        BuildCodes(literalLengths, 286, literalCodes);
+        BuildCodes(distanceLengths, 30, distanceCodes);
+
+        int numLiteralCodes = 286;
+        while (numLiteralCodes > 257 && !literalLengths[numLiteralCodes - 1])
+            numLiteralCodes--;
+        int numDistanceCodes = 30;
+        while (numDistanceCodes > 1 && !distanceLengths[numDistanceCodes - 1])
+            numDistanceCodes--;
+
+        // The code lengths are sent run length encoded, with their own Huffman code.
+        uint8_t lengths[286 + 30];
+        memcpy(lengths, literalLengths, numLiteralCodes);
+        memcpy(lengths + numLiteralCodes, distanceLengths, numDistanceCodes);
+        int numLengths = numLiteralCodes + numDistanceCodes;
+
+        uint8_t runSymbols[286 + 30];
+        uint8_t runExtra[286 + 30];
+        int numRuns = 0;
+        for (int i = 0; i < numLengths; )
+        {
+            int value = lengths[i];
+            int run = 1;
+            while (i + run < numLengths && lengths[i + run] == value)
+                run++;
+            i += run;
+
+            if (value == 0)
+            {
+                for ( ; run >= 11; run -= std::min(run, 138))
+                {
+                    runSymbols[numRuns] = 18;
+                    runExtra[numRuns++] = (uint8_t)(std::min(run, 138) - 11);
+                }
+                if (run >= 3)
+                {
+                    runSymbols[numRuns] = 17;
+                    runExtra[numRuns++] = (uint8_t)(run - 3);
+                    run = 0;
+                }
+            }
+            else
+            {
+                // A length has to be sent once before it can be repeated.
+                runSymbols[numRuns] = (uint8_t)value;
+                runExtra[numRuns++] = 0;
+                run--;
+                for ( ; run >= 3; run -= std::min(run, 6))
+                {
+                    runSymbols[numRuns] = 16;
+                    runExtra[numRuns++] = (uint8_t)(std::min(run, 6) - 3);
+                }
+            }
+
+            for ( ; run > 0; run--)
+            {
+                runSymbols[numRuns] = (uint8_t)value;
+                runExtra[numRuns++] = 0;
+            }
+        }
+
+        uint32_t runFrequencies[19] = {};
+        for (int i = 0; i < numRuns; i++)
+            runFrequencies[runSymbols[i]]++;
+
+        uint8_t runLengths[19];
+        uint16_t runCodes[19];
+        BuildCodeLengths(runFrequencies, 19, 7, runLengths);
+        BuildCodes(runLengths, 19, runCodes);
+
+        int numRunCodes = 19;
+        while (numRunCodes > 4 && !runLengths[CodeLengthOrder[numRunCodes - 1]])
+            numRunCodes--;
+
+        // Block header: final flag, dynamic Huffman type, then the code tables.
+        WriteBits(final ? 1 : 0, 1);
+        WriteBits(2, 2);
+        WriteBits(numLiteralCodes - 257, 5);
+        WriteBits(numDistanceCodes - 1, 5);
+        WriteBits(numRunCodes - 4, 4);
+        for (int i = 0; i < numRunCodes; i++)
+            WriteBits(runLengths[CodeLengthOrder[i]], 3);
+        for (int i = 0; i < numRuns; i++)
+        {
+            int symbol = runSymbols[i];
+            WriteBits(runCodes[symbol], runLengths[symbol]);
+            if (symbol == 16)
+                WriteBits(runExtra[i], 2);
+            else if (symbol == 17)
+                WriteBits(runExtra[i], 3);
+            else if (symbol == 18)
+                WriteBits(runExtra[i], 7);
+        }
+
+        const SymbolTables& tables = GetSymbolTables();
+        for (size_t i = 0; i < numTokens; i++)
+        {
+            uint32_t token = m_tokens[i];
+            if (token < 256)
+            {
+                WriteBits(literalCodes[token], literalLengths[token]);
+                continue;
+            }
+
+            int length = token >> 16;
+            int distance = token & 0xffff;
+            int lengthCode = tables.lengthCode[length];
+            WriteBits(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+            WriteBits(length - LengthBase[lengthCode], LengthExtra[lengthCode]);
+            int distanceCode = tables.DistanceCode(distance);
+            WriteBits(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+            WriteBits(distance - DistanceBase[distanceCode], DistanceExtra[distanceCode]);
+        }
+        WriteBits(literalCodes[EndOfBlock], literalLengths[EndOfBlock]);
+    }
+
+    void WritePNGChunk(FileWriter* file, const char* type, const uint8_t* data, uint32_t length)
+    {
+        uint8_t header[8];
+        PutU32BE(header, length);
+        memcpy(header + 4, type, 4);
+        uint8_t footer[4];
+        PutU32BE(footer, UpdateCrc32(UpdateCrc32(0, header + 4, 4), data, length));
+
+        file->Write(header, sizeof(header));
+        file->Write(data, length);
+        file->Write(footer, sizeof(footer));
+    }
+
+    void PNGCompressor::WriteChunk()
+    {
+        WritePNGChunk(m_file, "IDAT", m_output.data(), (uint32_t)m_output.size());
+        m_output.clear();
+    }
+}
+
+bool Pixie::SavePNG(const char* filename, const uint32_t* pixels, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return false;
+
+    FileWriter file(filename);
+    if (!file.IsOpen())
+        return false;
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    file.Write(signature, sizeof(signature));
+
+    // 8 bit RGB, not interlaced.
+    uint8_t header[13] = {};
+    PutU32BE(header, width);
+    PutU32BE(header + 4, height);
+    header[8] = 8;
+    header[9] = 2;
+    WritePNGChunk(&file, "IHDR", header, sizeof(header));
+
+    // Every row uses the Up filter (the first one has nothing above it, which leaves it as is).
+    // Repeated rows become runs of zeros, which the compressor turns into a few long matches.
+    size_t rowSize = 1 + (size_t)width * 3;
+    std::vector<uint8_t> previous(rowSize, 0);
+    std::vector<uint8_t> current(rowSize);
+    std::vector<uint8_t> filtered(rowSize);
+    filtered[0] = 2;
+
+    PNGCompressor compressor(&file);
+    for (int y = 0; y < height; y++)
+    {
+        const uint32_t* src = pixels + (size_t)y * width;
+        for (int x = 0; x < width; x++)
+        {
+            uint32_t pixel = src[x];
+            uint8_t* rgb = &current[1 + x * 3];
+            rgb[0] = (uint8_t)(pixel >> 16);
+            rgb[1] = (uint8_t)(pixel >> 8);
+            rgb[2] = (uint8_t)pixel;
+        }
+        for (size_t i = 1; i < rowSize; i++)
+            filtered[i] = (uint8_t)(current[i] - previous[i]);
+
+        compressor.Write(filtered.data(), rowSize);
+        current.swap(previous);
+    }
+    compressor.Finish();
+
+    WritePNGChunk(&file, "IEND", 0, 0);
+    return file.Close();
+}
+
+bool Pixie::SaveQOI(const char* filename, const uint32_t* pixels, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return false;
+
+    FileWriter file(filename);
+    if (!file.IsOpen())
+        return false;
+
+    // Header: magic, size, 3 channels, sRGB.
+    uint8_t header[14] = { 'q', 'o', 'i', 'f' };
+    PutU32BE(header + 4, width);
+    PutU32BE(header + 8, height);
+    header[12] = 3;
+    header[13] = 0;
+    file.Write(header, sizeof(header));
+
+    std::vector<uint8_t> output;
+    output.reserve(OutputBlockSize + 8);
+
+    // Pixels are compared without their top byte, every pixel is written with an alpha of 255.
+    uint32_t index[64] = {};
+    uint32_t previous = 0;
+    int run = 0;
+    size_t numPixels = (size_t)width * height;
+    for (size_t i = 0; i < numPixels; i++)
+    {
+        uint32_t pixel = pixels[i] & 0xffffff;
+        if (pixel == previous)
+        {
+            if (++run == 62)
+            {
+                output.push_back((uint8_t)(0xc0 | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0)
+        {
+            output.push_back((uint8_t)(0xc0 | (run - 1)));
+            run = 0;
+        }
+
+        int r = (pixel >> 16) & 0xff;
+        int g = (pixel >> 8) & 0xff;
+        int b = pixel & 0xff;
+        int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) & 63;
+
+        // The index is zeroed, so store pixels with their alpha to tell black from an empty slot.
+        if (index[hash] == (pixel | 0xff000000))
+        {
+            output.push_back((uint8_t)hash);
+        }
+        else
+        {
+            index[hash] = pixel | 0xff000000;
+
+            int dr = (int8_t)(r - ((previous >> 16) & 0xff));
+            int dg = (int8_t)(g - ((previous >> 8) & 0xff));
+            int db = (int8_t)(b - (previous & 0xff));
+            int dgr = dr - dg;
+            int dgb = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+            {
+                output.push_back((uint8_t)(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+            }
+            else if (dg >= -32 && dg <= 31 && dgr >= -8 && dgr <= 7 && dgb >= -8 && dgb <= 7)
+            {
+                output.push_back((uint8_t)(0x80 | (dg + 32)));
+                output.push_back((uint8_t)(((dgr + 8) << 4) | (dgb + 8)));
+            }
+            else
+            {
+                uint8_t rgb[4] = { 0xfe, (uint8_t)r, (uint8_t)g, (uint8_t)b };
+                output.insert(output.end(), rgb, rgb + 4);
+            }
+        }
+        previous = pixel;
+
+        if (output.size() >= OutputBlockSize)
+        {
+            file.Write(output.data(), output.size());
+            output.clear();
+        }
+    }
+
+    if (run > 0)
+        output.push_back((uint8_t)(0xc0 | (run - 1)));
+
+    static const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    output.insert(output.end(), end, end + sizeof(end));
+    file.Write(output.data(), output.size());
+
+    return file.Close();
+}
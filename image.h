@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace Pixie
+{
+    // Lossless image writers for screenshots. Pixels are xRGB like the window's buffer, the top
+    // byte is ignored and the images are saved as opaque RGB. Rows are encoded and written to
+    // disk as they go, so the whole file is never held in memory.
+
+    // Saves a PNG using the Up filter and a fast greedy deflate with per block Huffman codes.
+    bool SavePNG(const char* filename, const uint32_t* pixels, int width, int height);
+
+    // Saves a QOI (https://qoiformat.org) image, which is faster than PNG but compresses less.
+    bool SaveQOI(const char* filename, const uint32_t* pixels, int width, int height);
+}
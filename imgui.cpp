@@ -1,66 +1,322 @@
 ﻿#include "imgui.h"
 #include "pixie.h"
 #include "font.h"
+#include "span.h"
+#include "draw.h"
+#include "jobs.h"
+#include "plot.h"
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <algorithm>
+#include <cmath>
 
 using namespace Pixie;
 
-struct State
+// The context being built on this thread, between Begin and End.
+static thread_local ImGuiContext* s_context = 0;
+// The window input comes from, null when drawing offscreen.
+static thread_local Window* s_window = 0;
+
+// The ID at the bottom of every context's ID stack.
+static const uint32_t IdSeed = 2166136261u;
+
+// Widgets unused for this many frames lose their state.
+static const uint32_t StatePruneInterval = 600;
+
+static const int MinStateCapacity = 64;
+
+// Far outside any widget, used as the mouse position when there's no window.
+static const int NoMouse = -0x40000000;
+
+ImGuiContext::ImGuiContext()
 {
-    enum Flags
-    {
-        Flags_Started = 1 << 0,
-    };
+    flags = 0;
+    hoverId = 0;
+    focusId = 0;
+    keyboardCursorPosition = 0;
+    keyRepeatTimer = 0.0f;
+    keyRepeatTime = 0.0f;
+    cursorBlinkTimer = 0.0f;
+    defaultTextColour = MAKE_RGB(200, 200, 200);
+    font = 0;
+    pixels = 0;
+    width = 0;
+    height = 0;
+    numStates = 0;
+    frame = 0;
+    stateFont = 0;
+    inList = false;
+    inTable = false;
+    tableX = 0;
+    tableY = 0;
+    tableScroll = 0;
+    tableRowHeight = 0;
+    tableColumnCount = 0;
+    listY = 0;
+    listScroll = 0;
+    listItemHeight = 0;
+    retained = false;
+    redrawAll = true;
+    backgroundColour = 0;
+    retainedPixels = 0;
+    retainedWidth = 0;
+    retainedHeight = 0;
+}
 
-    bool HasStarted() { return (flags & Flags_Started) != 0; }
-    int GetNextId() { return nextId++; }
+void ImGuiContext::SetRetained(bool enabled, uint32_t colour /*= 0*/)
+{
+    retained = enabled;
+    backgroundColour = colour;
+    redrawAll = true;
+}
 
-    int flags;
-    int nextId;
-    int hoverId;
-    int focusId;
-    int keyboardCursorPosition;
-    float keyRepeatTimer;
-    float keyRepeatTime;
-    float cursorBlinkTimer;
-    uint32_t defaultTextColour;
+// Input and invalidation go through the window when there is one. Offscreen targets get no input.
+static int GetMouseX()
+{
+    return s_window ? s_window->GetMouseX() : NoMouse;
+}
 
-    Window* window;
-    Font* font;
-};
+static int GetMouseY()
+{
+    return s_window ? s_window->GetMouseY() : NoMouse;
+}
+
+static bool HasMouseGoneDown(MouseButton button)
+{
+    return s_window && s_window->HasMouseGoneDown(button);
+}
 
-static State s_state = { 0 };
+static bool HasMouseGoneUp(MouseButton button)
+{
+    return s_window && s_window->HasMouseGoneUp(button);
+}
 
-void ImGui::Begin(Window* window, Font* font)
+static bool IsMouseDown(MouseButton button)
+{
+    return s_window && s_window->IsMouseDown(button);
+}
+
+static bool IsKeyDown(Key key)
+{
+    return s_window && s_window->IsKeyDown(key);
+}
+
+static bool HasAnyKeyGoneDown()
+{
+    return s_window && s_window->HasAnyKeyGoneDown();
+}
+
+static bool IsAnyKeyDown()
+{
+    return s_window && s_window->IsAnyKeyDown();
+}
+
+static const char* GetInputCharacters()
+{
+    return s_window ? s_window->GetInputCharacters() : "";
+}
+
+static void ClearInputCharacters()
+{
+    if (s_window)
+        s_window->ClearInputCharacters();
+}
+
+static float GetMouseWheel()
+{
+    return s_window ? s_window->GetMouseWheel() : 0.0f;
+}
+
+static float GetDelta()
+{
+    return s_window ? s_window->GetDelta() : 0.0f;
+}
+
+static void Invalidate(int x, int y, int width, int height)
+{
+    if (s_window)
+        s_window->Invalidate(x, y, width, height);
+}
+
+void ImGui::Begin(Window* window, Font* font, ImGuiContext* context /*= 0*/)
 {
     assert(window);
+    Begin(window->GetPixels(), window->GetWidth(), window->GetHeight(), font, context);
+    s_window = window;
+}
+
+void ImGui::Begin(uint32_t* pixels, int width, int height, Font* font, ImGuiContext* context /*= 0*/)
+{
+    assert(pixels);
     assert(font);
+    assert(!s_context);
+
+    static thread_local ImGuiContext defaultContext;
+    s_context = context ? context : &defaultContext;
+
+    s_context->flags = ImGuiContext::Flags_Started;
+    s_context->hoverId = 0;
+    s_context->idStack.assign(1, IdSeed);
+    ImGuiContext::ClipRect targetRect = { 0, 0, width, height };
+    s_context->clipStack.assign(1, targetRect);
+    s_window = 0;
+    s_context->font = font;
+    s_context->pixels = pixels;
+    s_context->width = width;
+    s_context->height = height;
+    s_context->commands.clear();
+    s_context->text.clear();
+
+    // Cached text widths are only good for the font they were measured with, so measure them
+    // again, but keep scroll positions and sizes the user has set.
+    if (font != s_context->stateFont)
+    {
+        for (size_t i = 0; i < s_context->states.size(); i++)
+        {
+            if (s_context->states[i].id != 0)
+                s_context->states[i].textWidth = -1;
+        }
+        s_context->stateFont = font;
+    }
+
+    // Every so often forget widgets that haven't been seen for a while.
+    s_context->frame++;
+    if ((s_context->frame % StatePruneInterval) == 0 && !s_context->states.empty())
+    {
+        int capacity = (int)s_context->states.size();
+        s_context->RebuildStates(capacity, s_context->frame - StatePruneInterval);
+        if (s_context->numStates * 4 < capacity && capacity > MinStateCapacity)
+        {
+            while (s_context->numStates * 4 < capacity && capacity > MinStateCapacity)
+                capacity /= 2;
+            s_context->RebuildStates(capacity, 0);
+        }
+    }
+}
+
+static uint32_t HashBytes(uint32_t hash, const void* data, size_t size)
+{
+    // FNV-1a.
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    // 0 means no widget.
+    return hash ? hash : 1;
+}
+
+uint32_t ImGui::GetID(const char* id)
+{
+    assert(s_context && s_context->HasStarted());
+    return HashBytes(s_context->idStack.back(), id, strlen(id));
+}
+
+uint32_t ImGui::GetID(const void* id)
+{
+    assert(s_context && s_context->HasStarted());
+    return HashBytes(s_context->idStack.back(), &id, sizeof(id));
+}
+
+void ImGui::PushID(const char* id)
+{
+    s_context->idStack.push_back(GetID(id));
+}
+
+void ImGui::PushID(const void* id)
+{
+    s_context->idStack.push_back(GetID(id));
+}
+
+void ImGui::PushID(int id)
+{
+    assert(s_context && s_context->HasStarted());
+    s_context->idStack.push_back(HashBytes(s_context->idStack.back(), &id, sizeof(id)));
+}
+
+void ImGui::PopID()
+{
+    assert(s_context && s_context->HasStarted());
+    assert(s_context->idStack.size() > 1);
+    s_context->idStack.pop_back();
+}
 
-    s_state.flags = State::Flags_Started;
-    s_state.nextId = 1;
-    s_state.hoverId = 0;
-    s_state.window = window;
-    s_state.font = font;
-    s_state.defaultTextColour = MAKE_RGB(200, 200, 200);
+ImGuiContext::WidgetState& ImGuiContext::GetState(uint32_t id)
+{
+    // Keep the table at most three quarters full so probes stay short.
+    if ((numStates + 1) * 4 > (int)states.size() * 3)
+        RebuildStates(std::max((int)states.size() * 2, MinStateCapacity), 0);
+
+    uint32_t mask = (uint32_t)states.size() - 1;
+    for (uint32_t i = id & mask; ; i = (i + 1) & mask)
+    {
+        WidgetState& state = states[i];
+        if (state.id == id)
+        {
+            state.lastFrame = frame;
+            return state;
+        }
+
+        if (state.id == 0)
+        {
+            state.id = id;
+            state.lastFrame = frame;
+            state.textWidth = -1;
+            state.scroll = 0.0;
+            state.scrollTarget = 0.0;
+            state.size = -1;
+            numStates++;
+            return state;
+        }
+    }
+}
+
+void ImGuiContext::RebuildStates(int capacity, uint32_t oldestFrame)
+{
+    std::vector<WidgetState> old;
+    old.swap(states);
+
+    WidgetState empty;
+    memset(&empty, 0, sizeof(empty));
+    states.assign(capacity, empty);
+    numStates = 0;
+
+    uint32_t mask = (uint32_t)capacity - 1;
+    for (size_t i = 0; i < old.size(); i++)
+    {
+        // Compare ages rather than frames so this still works when the frame counter wraps.
+        if (old[i].id == 0 || frame - old[i].lastFrame > frame - oldestFrame)
+            continue;
+
+        uint32_t slot = old[i].id & mask;
+        while (states[slot].id != 0)
+            slot = (slot + 1) & mask;
+        states[slot] = old[i];
+        numStates++;
+    }
 }
 
 void ImGui::End()
 {
-    s_state.flags = 0;
+    assert(s_context && s_context->HasStarted());
+    assert(s_context->idStack.size() == 1 && "PushID without PopID");
+    assert(s_context->clipStack.size() == 1 && "BeginList or BeginTable without an End");
+    s_context->flags = 0;
 
-    if (s_state.window->HasMouseGoneDown(Pixie::MouseButton_Left))
+    if (HasMouseGoneDown(Pixie::MouseButton_Left))
     {
         // If mouse has gone down over empty space, clear the current focus.
-        if (s_state.hoverId == 0)
+        if (s_context->hoverId == 0)
         {
-            s_state.focusId = 0;
-            s_state.keyboardCursorPosition = 0;
+            s_context->focusId = 0;
+            s_context->keyboardCursorPosition = 0;
         }
     }
 
-    s_state.window = 0;
+    s_context->RasterizeTiles();
+
+    s_window = 0;
+    s_context = 0;
 }
 
 template<typename T>
@@ -72,22 +328,20 @@ void clamp(T min, T max, T &value)
 
 void ImGui::SliderFloat(float &value, float min, float max, int x, int y, int width, int height)
 {
-    assert(s_state.HasStarted());
-    Window *window = s_state.window;
-    int id = s_state.GetNextId();
+    assert(s_context && s_context->HasStarted());
+    uint32_t id = GetID(&value);
 
     const uint32_t NormalColour = MAKE_RGB(32, 50, 77);
     const uint32_t HoverColour = MAKE_RGB(39, 73, 114);
     const uint32_t BorderColour = MAKE_RGB(68, 79, 103);
 
-    int mouseX = window->GetMouseX();
-    int mouseY = window->GetMouseY();
-    bool hover = mouseX >= x-5 && mouseX <= x + width+5 && mouseY >= y && mouseY <= y + height;
+    int mouseX = GetMouseX();
+    bool hover = IsMouseOver(x - 5, y, width + 10, height);
 
     FilledRect(x, y, width, height, hover?HoverColour:NormalColour, BorderColour);
     if (hover) {
-        s_state.hoverId = id;
-        if (window->IsMouseDown(Pixie::MouseButton_Left)) {
+        s_context->hoverId = id;
+        if (IsMouseDown(Pixie::MouseButton_Left)) {
             value = (max-min)*(float)((mouseX-x))/(float)(width);
             clamp<float>(min, max, value);
         }
@@ -95,28 +349,26 @@ void ImGui::SliderFloat(float &value, float min, float max, int x, int y, int wi
     FilledRect(x+static_cast<int>(width*value/(max-min))-5, y, 10, height, MAKE_RGB(255,255,255), MAKE_RGB(255,255,255));
     char labelText[10];
     sprintf(labelText, "%.2f\0", value);
-    Label(labelText, x+width+10, y+height/2-s_state.font->GetCharacterHeight()/2, s_state.defaultTextColour);
+    Label(labelText, x+width+10, y+height/2-s_context->font->GetCharacterHeight()/2, s_context->defaultTextColour);
 }
 
 void ImGui::SliderInt(int &value, int min, int max, int x, int y, int width, int height)
 {
-    assert(s_state.HasStarted());
-    Window *window = s_state.window;
-    int id = s_state.GetNextId();
+    assert(s_context && s_context->HasStarted());
+    uint32_t id = GetID(&value);
 
     const uint32_t NormalColour = MAKE_RGB(32, 50, 77);
     const uint32_t HoverColour = MAKE_RGB(39, 73, 114);
     const uint32_t BorderColour = MAKE_RGB(68, 79, 103);
 
-    int mouseX = window->GetMouseX();
-    int mouseY = window->GetMouseY();
-    bool hover = mouseX >= x-5 && mouseX <= x + width+5 && mouseY >= y && mouseY <= y + height;
+    int mouseX = GetMouseX();
+    bool hover = IsMouseOver(x - 5, y, width + 10, height);
 
     FilledRect(x, y, width, height, hover?HoverColour:NormalColour, BorderColour);
     int stepSize = static_cast<int>(width/(float)(max-min));
     if (hover) {
-        s_state.hoverId = id;
-        if (window->IsMouseDown(Pixie::MouseButton_Left)) {
+        s_context->hoverId = id;
+        if (IsMouseDown(Pixie::MouseButton_Left)) {
             value = static_cast<int>((max-min)*((float)(mouseX-x))/width);
             clamp<int>(min, max, value);
         }
@@ -124,71 +376,84 @@ void ImGui::SliderInt(int &value, int min, int max, int x, int y, int width, int
     FilledRect(x+stepSize*value-5, y, 10, height, MAKE_RGB(255,255,255), MAKE_RGB(255,255,255));
     char labelText[10];
     sprintf(labelText, "%d\0", value);
-    Label(labelText, x+width+10, y+height/2-s_state.font->GetCharacterHeight()/2, s_state.defaultTextColour);
+    Label(labelText, x+width+10, y+height/2-s_context->font->GetCharacterHeight()/2, s_context->defaultTextColour);
 }
 
 void ImGui::Label(const char* text, int x, int y, uint32_t colour)
 {
     assert(text);
-    assert(s_state.HasStarted());
-    s_state.font->DrawColour(text, x, y, colour, s_state.window);
+    assert(s_context && s_context->HasStarted());
+    s_context->AddText(text, x, y, colour);
 }
 
 bool ImGui::Button(const char* label, int x, int y, int width, int height)
 {
-    assert(s_state.HasStarted());
+    assert(s_context && s_context->HasStarted());
 
-    Window* window = s_state.window;
-    int id = s_state.GetNextId();
+    // Buttons without a label are told apart by where they are.
+    uint32_t id;
+    if (label)
+    {
+        id = GetID(label);
+    }
+    else
+    {
+        int position[2] = { x, y };
+        id = HashBytes(s_context->idStack.back(), position, sizeof(position));
+    }
+
+    return ButtonBehaviour(id, label, x, y, width, height);
+}
 
+bool ImGui::ButtonBehaviour(uint32_t id, const char* label, int x, int y, int width, int height)
+{
     const uint32_t NormalColour = MAKE_RGB(32, 50, 77);
     const uint32_t HoverColour = MAKE_RGB(39, 73, 114);
     const uint32_t PressedColour = MAKE_RGB(22, 40, 67);
     const uint32_t BorderColour = MAKE_RGB(68, 79, 103);
     const uint32_t FocusBorderColour = MAKE_RGB(200, 200, 229);
 
-    int mouseX = window->GetMouseX();
-    int mouseY = window->GetMouseY();
-
-    bool hover = mouseX >= x && mouseX <= x + width && mouseY >= y && mouseY <= y + height;
+    bool hover = IsMouseOver(x, y, width, height);
     bool pressed = false;
 
     if (hover)
     {
-        s_state.hoverId = id;
+        s_context->hoverId = id;
 
         // Mouse has just gone down over this element, so give it focus.
-        if (window->HasMouseGoneDown(Pixie::MouseButton_Left))
-            s_state.focusId = id;
+        if (HasMouseGoneDown(Pixie::MouseButton_Left))
+            s_context->focusId = id;
 
         // If mouse is still down over this element and it has focus, then it is pressed.
-        pressed = window->IsMouseDown(Pixie::MouseButton_Left) && s_state.focusId == id;
+        pressed = IsMouseDown(Pixie::MouseButton_Left) && s_context->focusId == id;
     }
 
     uint32_t buttonColour = pressed ? PressedColour : hover ? HoverColour : NormalColour;
-    uint32_t borderColour = s_state.focusId == id ? FocusBorderColour : BorderColour;
+    uint32_t borderColour = s_context->focusId == id ? FocusBorderColour : BorderColour;
 
     FilledRect(x, y, width, height, buttonColour, borderColour);
 
     if (label)
     {
-        Font* font = s_state.font;
-        int textX = x + ((width - font->GetStringWidth(label)) >> 1);
+        // The ID is hashed from the label, so the width measured when the widget first appeared holds.
+        Font* font = s_context->font;
+        ImGuiContext::WidgetState& state = s_context->GetState(id);
+        if (state.textWidth < 0)
+            state.textWidth = font->GetStringWidth(label);
+        int textX = x + ((width - state.textWidth) >> 1);
         int textY = y + ((height - font->GetCharacterHeight()) >> 1);
 
-        Label(label, textX, textY, s_state.defaultTextColour);
+        Label(label, textX, textY, s_context->defaultTextColour);
     }
 
-    return hover && s_state.focusId == id && window->HasMouseGoneUp(Pixie::MouseButton_Left);
+    return hover && s_context->focusId == id && HasMouseGoneUp(Pixie::MouseButton_Left);
 }
 
 void ImGui::Input(char* text, int textBufferLength, int x, int y, int width, int height)
 {
     assert(text);
-    assert(s_state.HasStarted());
-
-    Window* window = s_state.window;
-    int id = s_state.GetNextId();
+    assert(s_context && s_context->HasStarted());
+    uint32_t id = GetID((const void*)text);
 
     const int LeftMargin = 8;
     const uint32_t NormalColour = MAKE_RGB(64, 68, 71);
@@ -201,10 +466,8 @@ void ImGui::Input(char* text, int textBufferLength, int x, int y, int width, int
     const float KeyRepeatTimeRepeat = 0.05f;
     const float CursorBlinkTime = 1.0f;
 
-    int mouseX = window->GetMouseX();
-    int mouseY = window->GetMouseY();
-
-    bool hover = mouseX >= x && mouseX <= x + width && mouseY >= y && mouseY <= y + height;
+    int mouseX = GetMouseX();
+    bool hover = IsMouseOver(x, y, width, height);
     bool pressed = false;
     int textLength = (int)strlen(text);
 
@@ -212,91 +475,91 @@ void ImGui::Input(char* text, int textBufferLength, int x, int y, int width, int
 
     if (hover)
     {
-        s_state.hoverId = id;
+        s_context->hoverId = id;
 
         // Mouse has just gone down over this element, so give it focus.
-        if (window->HasMouseGoneDown(Pixie::MouseButton_Left))
+        if (HasMouseGoneDown(Pixie::MouseButton_Left))
         {
-            if (s_state.focusId != id)
+            if (s_context->focusId != id)
             {
-                s_state.keyRepeatTimer = 0.0f;
-                s_state.cursorBlinkTimer = 0.0f;
-                s_state.focusId = id;
+                s_context->keyRepeatTimer = 0.0f;
+                s_context->cursorBlinkTimer = 0.0f;
+                s_context->focusId = id;
             }
 
             // Move the cursor to whereever the user clicked.
-            s_state.keyboardCursorPosition = std::min((mouseX - textX) / s_state.font->GetCharacterWidth(), textLength);
+            s_context->keyboardCursorPosition = std::min((mouseX - textX) / s_context->font->GetCharacterWidth(), textLength);
 
             // Also force the cursor to be visible.
-            s_state.cursorBlinkTimer = CursorBlinkTime;
+            s_context->cursorBlinkTimer = CursorBlinkTime;
         }
 
         // If mouse is still down over this element and it has focus, then it is pressed.
-        pressed = window->IsMouseDown(Pixie::MouseButton_Left) && s_state.focusId == id;
+        pressed = IsMouseDown(Pixie::MouseButton_Left) && s_context->focusId == id;
     }
 
-    uint32_t boxColour = pressed || hover || s_state.focusId == id ? HoverColour : NormalColour;
-    uint32_t borderColour = s_state.focusId == id ? FocusBorderColour : BorderColour;
+    uint32_t boxColour = pressed || hover || s_context->focusId == id ? HoverColour : NormalColour;
+    uint32_t borderColour = s_context->focusId == id ? FocusBorderColour : BorderColour;
 
     // Draw the input field.
     FilledRect(x, y, width, height, boxColour, borderColour);
 
-    int textY = y + ((height - s_state.font->GetCharacterHeight()) >> 1);
-    Label(text, textX, textY, s_state.defaultTextColour);
+    int textY = y + ((height - s_context->font->GetCharacterHeight()) >> 1);
+    Label(text, textX, textY, s_context->defaultTextColour);
 
-    if (s_state.focusId == id)
+    if (s_context->focusId == id)
     {
-        float delta = window->GetDelta();
+        float delta = GetDelta();
 
         // Input field has focus, draw the keyboard cursor and process input.
-        s_state.cursorBlinkTimer -= delta;
-        if (s_state.cursorBlinkTimer >= CursorBlinkTime * 0.5f)
-            FilledRect(textX + (s_state.keyboardCursorPosition * s_state.font->GetCharacterWidth()), textY + s_state.font->GetCharacterHeight() - 2, CursorWidth, 2, CursorColour, CursorColour);
-        if (s_state.cursorBlinkTimer <= 0.0f || window->IsAnyKeyDown())
-            s_state.cursorBlinkTimer = CursorBlinkTime;
+        s_context->cursorBlinkTimer -= delta;
+        if (s_context->cursorBlinkTimer >= CursorBlinkTime * 0.5f)
+            FilledRect(textX + (s_context->keyboardCursorPosition * s_context->font->GetCharacterWidth()), textY + s_context->font->GetCharacterHeight() - 2, CursorWidth, 2, CursorColour, CursorColour);
+        if (s_context->cursorBlinkTimer <= 0.0f || IsAnyKeyDown())
+            s_context->cursorBlinkTimer = CursorBlinkTime;
 
         // TODO: Not sure if this is the right way to do this. The timer should probably be per-key.
-        if (window->HasAnyKeyGoneDown())
+        if (HasAnyKeyGoneDown())
         {
-            s_state.keyRepeatTimer = 0.0f;
-            s_state.keyRepeatTime = KeyRepeatTimeInit;
+            s_context->keyRepeatTimer = 0.0f;
+            s_context->keyRepeatTime = KeyRepeatTimeInit;
         }
 
-        s_state.keyRepeatTimer -= delta;
-        if (s_state.keyRepeatTimer <= 0.0f)
+        s_context->keyRepeatTimer -= delta;
+        if (s_context->keyRepeatTimer <= 0.0f)
         {
-            s_state.keyRepeatTimer = s_state.keyRepeatTime;
-            s_state.keyRepeatTime = KeyRepeatTimeRepeat;
+            s_context->keyRepeatTimer = s_context->keyRepeatTime;
+            s_context->keyRepeatTime = KeyRepeatTimeRepeat;
 
-            if (window->IsKeyDown(Pixie::Key_Left))
+            if (IsKeyDown(Pixie::Key_Left))
             {
-                s_state.keyboardCursorPosition = std::max(s_state.keyboardCursorPosition - 1, 0);
+                s_context->keyboardCursorPosition = std::max(s_context->keyboardCursorPosition - 1, 0);
             }
-            else if (window->IsKeyDown(Pixie::Key_Right))
+            else if (IsKeyDown(Pixie::Key_Right))
             {
-                s_state.keyboardCursorPosition = std::min(s_state.keyboardCursorPosition + 1, textLength);
+                s_context->keyboardCursorPosition = std::min(s_context->keyboardCursorPosition + 1, textLength);
             }
-            else if (window->IsKeyDown(Pixie::Key_Backspace))
+            else if (IsKeyDown(Pixie::Key_Backspace))
             {
                 // Move cursor back.
-                s_state.keyboardCursorPosition--;
+                s_context->keyboardCursorPosition--;
 
-                if (s_state.keyboardCursorPosition >= 0)
+                if (s_context->keyboardCursorPosition >= 0)
                 {
                     // Copy everything after the current position to the current position.
-                    int position = s_state.keyboardCursorPosition;
+                    int position = s_context->keyboardCursorPosition;
                     int copyAmount = (int)strlen(text + position + 1) + 1;
                     memcpy(text + position, text + position + 1, copyAmount);
                 }
                 else
                 {
-                    s_state.keyboardCursorPosition = 0;
+                    s_context->keyboardCursorPosition = 0;
                 }
             }
-            else if (window->IsKeyDown(Pixie::Key_Delete))
+            else if (IsKeyDown(Pixie::Key_Delete))
             {
                 // Delete the current character.
-                int position = s_state.keyboardCursorPosition;
+                int position = s_context->keyboardCursorPosition;
                 if (position < textLength)
                 {
                     // Copy everything after the current position to the current position.
@@ -304,27 +567,27 @@ void ImGui::Input(char* text, int textBufferLength, int x, int y, int width, int
                     memcpy(text + position, text + position + 1, copyAmount);
                 }
             }
-            else if (window->IsKeyDown(Pixie::Key_Home))
+            else if (IsKeyDown(Pixie::Key_Home))
             {
-                s_state.keyboardCursorPosition = 0;
+                s_context->keyboardCursorPosition = 0;
             }
-            else if (window->IsKeyDown(Pixie::Key_End))
+            else if (IsKeyDown(Pixie::Key_End))
             {
-                s_state.keyboardCursorPosition = textLength;
+                s_context->keyboardCursorPosition = textLength;
             }
         }
 
         // Process remaining ASCII input.
-        const char* inputCharacters = window->GetInputCharacters();
+        const char* inputCharacters = GetInputCharacters();
         if (*inputCharacters)
         {
             for ( ; *inputCharacters; inputCharacters++)
             {
-                if (s_state.keyboardCursorPosition == textBufferLength - 1)
+                if (s_context->keyboardCursorPosition == textBufferLength - 1)
                     break;
 
                 // Overwrite the character at the current position.
-                int position = s_state.keyboardCursorPosition;
+                int position = s_context->keyboardCursorPosition;
                 assert(position >= 0 && position < textBufferLength - 1);
                 text[position] = *inputCharacters;
 
@@ -337,11 +600,11 @@ void ImGui::Input(char* text, int textBufferLength, int x, int y, int width, int
                 }
 
                 // Move the cursor.
-                s_state.keyboardCursorPosition = std::min(s_state.keyboardCursorPosition + 1, textBufferLength);
+                s_context->keyboardCursorPosition = std::min(s_context->keyboardCursorPosition + 1, textBufferLength);
             }
 
             // We have consumed the input so remove it from the buffer.
-            window->ClearInputCharacters();
+            ClearInputCharacters();
         }
     }
 }
@@ -349,19 +612,19 @@ void ImGui::Input(char* text, int textBufferLength, int x, int y, int width, int
 bool ImGui::Checkbox(const char* label, bool checked, int x, int y)
 {
     assert(label);
-    assert(s_state.HasStarted());
+    assert(s_context && s_context->HasStarted());
 
     const int TextLeftMargin = 8;
     const int BoxSize = 18;
     const int CheckSize = 8;
 
-    Font* font = s_state.font;
+    Font* font = s_context->font;
     int charHeight = font->GetCharacterHeight();
 
     int textY = y + ((BoxSize - charHeight) >> 1) + 1;
-    Label(label, x + BoxSize + TextLeftMargin, textY, s_state.defaultTextColour);
+    Label(label, x + BoxSize + TextLeftMargin, textY, s_context->defaultTextColour);
     bool wasChecked = checked;
-    if (Button(0, x, y, BoxSize, BoxSize))
+    if (ButtonBehaviour(GetID(label), 0, x, y, BoxSize, BoxSize))
         checked = !checked;
 
     if (wasChecked)
@@ -369,15 +632,7 @@ bool ImGui::Checkbox(const char* label, bool checked, int x, int y)
         // Draw check mark.
         int checkX = x + ((BoxSize - CheckSize) >> 1);
         int checkY = y + ((BoxSize - CheckSize) >> 1);
-        Window* window = s_state.window;
-        int windowWidth = window->GetWidth();
-        uint32_t* pixels = window->GetPixels();
-        y = checkY;
-        for (int yy = y*windowWidth, x = 0; y < checkY + CheckSize; y++, x++, yy += windowWidth)
-        {
-            pixels[checkX + x + yy] = MAKE_RGB(255, 255, 255);
-            pixels[checkX + CheckSize - x - 1 + yy] = MAKE_RGB(255, 255, 255);
-        }
+        s_context->AddRect(ImGuiContext::Command_Check, checkX, checkY, CheckSize, CheckSize, MAKE_RGB(255, 255, 255), MAKE_RGB(255, 255, 255));
     }
 
     return checked;
@@ -386,20 +641,20 @@ bool ImGui::Checkbox(const char* label, bool checked, int x, int y)
 bool ImGui::RadioButton(const char* label, bool checked, int x, int y)
 {
     assert(label);
-    assert(s_state.HasStarted());
+    assert(s_context && s_context->HasStarted());
 
     const int TextLeftMargin = 8;
     const int BoxSize = 18;
     const int CheckSize = 8;
-    const uint32_t FontColour = s_state.defaultTextColour;
+    const uint32_t FontColour = s_context->defaultTextColour;
 
-    Font* font = s_state.font;
+    Font* font = s_context->font;
     int charHeight = font->GetCharacterHeight();
 
     int textY = y + ((BoxSize - charHeight) >> 1) + 1;
     Label(label, x + BoxSize + TextLeftMargin, textY, FontColour);
     bool wasChecked = checked;
-    if (Button(0, x, y, BoxSize, BoxSize))
+    if (ButtonBehaviour(GetID(label), 0, x, y, BoxSize, BoxSize))
         checked = !checked;
 
     if (wasChecked)
@@ -413,65 +668,752 @@ bool ImGui::RadioButton(const char* label, bool checked, int x, int y)
     return checked;
 }
 
-void ImGui::Rect(int x, int y, int width, int height, uint32_t borderColour)
+void ImGui::PlotLines(const PlotBuffer& buffer, int x, int y, int width, int height, float minValue /*= 0.0f*/, float maxValue /*= 0.0f*/)
 {
-    assert(s_state.HasStarted());
-    Window* window = s_state.window;
-    uint32_t* pixels = window->GetPixels();
-    int windowWidth = window->GetWidth();
-    int windowHeight = window->GetHeight();
+    Plot(buffer, x, y, width, height, minValue, maxValue, false);
+}
+
+void ImGui::PlotHistogram(const PlotBuffer& buffer, int x, int y, int width, int height, float minValue /*= 0.0f*/, float maxValue /*= 0.0f*/)
+{
+    Plot(buffer, x, y, width, height, minValue, maxValue, true);
+}
+
+void ImGui::Plot(const PlotBuffer& buffer, int x, int y, int width, int height, float minValue, float maxValue, bool histogram)
+{
+    assert(s_context && s_context->HasStarted());
+
+    const uint32_t BackgroundColour = MAKE_RGB(40, 44, 47);
+    const uint32_t BorderColour = MAKE_RGB(104, 108, 111);
+    const uint32_t PlotColour = MAKE_RGB(110, 170, 230);
 
-    pixels += x + (y*windowWidth);
+    FilledRect(x, y, width, height, BackgroundColour, BorderColour);
 
-    for (int j = 0, ypos = y; j < height && ypos < windowHeight; j++, ypos++)
+    int plotX = x + 1;
+    int plotY = y + 1;
+    int plotWidth = width - 2;
+    int plotHeight = height - 2;
+    int count = buffer.GetCount();
+    if (plotWidth <= 0 || plotHeight <= 0 || count == 0)
+        return;
+
+    if (minValue >= maxValue && !buffer.GetRange(0, count, minValue, maxValue))
+        return;
+    if (minValue >= maxValue)
     {
-        int left = x;
-        if (left >= 0 && left < windowWidth)
-            *pixels = borderColour;
+        minValue -= 0.5f;
+        maxValue += 0.5f;
+    }
 
-        int right = x + width - 1;
-        if (right >= 0 && right < windowWidth)
-            *(pixels + width - 1) = borderColour;
+    // Maps a value to a row of the plot, clamped inside it.
+    float scale = (plotHeight - 1) / (maxValue - minValue);
+    auto toY = [&](float value)
+    {
+        float row = (value - minValue) * scale;
+        row = std::min(std::max(row, 0.0f), (float)(plotHeight - 1));
+        return plotY + plotHeight - 1 - (int)(row + 0.5f);
+    };
+
+    int baseline = toY(std::min(std::max(0.0f, minValue), maxValue));
+    int lastTop = 0;
+    int lastBottom = 0;
+    for (int column = 0; column < plotWidth; column++)
+    {
+        // Spread the samples evenly over the columns. With fewer samples than columns, each
+        // sample covers several.
+        int first = (int)(((int64_t)column * count) / plotWidth);
+        int end = std::max((int)(((int64_t)(column + 1) * count) / plotWidth), first + 1);
+
+        float low, high;
+        buffer.GetRange(first, end - first, low, high);
+        int top = toY(high);
+        int bottom = toY(low);
+
+        if (histogram)
+        {
+            top = std::min(top, baseline);
+            bottom = std::max(bottom, baseline);
+        }
+        else if (column > 0)
+        {
+            // Reach the previous column so the line doesn't break.
+            bottom = std::max(bottom, lastTop);
+            top = std::min(top, lastBottom);
+        }
+
+        FilledRect(plotX + column, top, 1, bottom - top + 1, PlotColour, PlotColour);
+        lastTop = toY(high);
+        lastBottom = toY(low);
+    }
+}
+
+bool ImGui::IsMouseOver(int x, int y, int width, int height)
+{
+    // Widgets can only be hovered through the part of them that isn't clipped away.
+    int mouseX = GetMouseX();
+    int mouseY = GetMouseY();
+    const ImGuiContext::ClipRect& clip = s_context->clipStack.back();
+    return mouseX >= x && mouseX <= x + width && mouseY >= y && mouseY <= y + height &&
+        mouseX >= clip.x0 && mouseX < clip.x1 && mouseY >= clip.y0 && mouseY < clip.y1;
+}
+
+void ImGui::ScrollBar(uint32_t id, bool vertical, int x, int y, int length, int64_t contentLength, int viewLength, float wheel, double& scroll, double& scrollTarget)
+{
+    const uint32_t BarColour = MAKE_RGB(90, 94, 97);
+    const uint32_t BarHoverColour = MAKE_RGB(130, 134, 137);
+    const int MinBarLength = 16;
+    const float ScrollSpeed = 15.0f;
+
+    double maxScroll = (double)std::max(contentLength - viewLength, (int64_t)0);
+
+    // The bar's length shows how much of the content is visible.
+    int barLength = contentLength > 0 ? (int)std::max((int64_t)length * viewLength / contentLength, (int64_t)MinBarLength) : length;
+    barLength = std::min(barLength, length);
 
-        pixels += windowWidth;
+    bool hover = maxScroll > 0.0 && (vertical ? IsMouseOver(x, y, ScrollBarSize, length) : IsMouseOver(x, y, length, ScrollBarSize));
+    if (hover)
+    {
+        s_context->hoverId = id;
+        if (HasMouseGoneDown(Pixie::MouseButton_Left))
+            s_context->focusId = id;
     }
 
-    pixels = window->GetPixels() + x + (y*windowWidth);
-    for (int i = 0, xpos = x; i < width; i++, xpos++)
+    // Dragging the bar jumps straight there.
+    bool dragging = s_context->focusId == id && IsMouseDown(Pixie::MouseButton_Left) && maxScroll > 0.0;
+    if (dragging && length > barLength)
     {
-        int top = y;
-        if (top >= 0 && top < windowHeight)
-            *pixels = borderColour;
+        int mouse = vertical ? GetMouseY() - y : GetMouseX() - x;
+        scrollTarget = (double)(mouse - (barLength / 2)) / (length - barLength) * maxScroll;
+    }
 
-        int bottom = y + height - 1;
-        if (bottom >= 0 && bottom < windowHeight)
-            *(pixels + ((height-1)*windowWidth)) = borderColour;
+    scrollTarget = std::min(std::max(scrollTarget - wheel, 0.0), maxScroll);
 
-        pixels++;
+    // Ease towards the target so wheel steps scroll smoothly.
+    float delta = GetDelta();
+    if (dragging || delta <= 0.0f)
+        scroll = scrollTarget;
+    else
+        scroll += (scrollTarget - scroll) * std::min(delta * ScrollSpeed, 1.0f);
+    if (std::abs(scrollTarget - scroll) < 0.5)
+        scroll = scrollTarget;
+
+    if (maxScroll > 0.0)
+    {
+        int barPosition = (int)((length - barLength) * (scroll / maxScroll));
+        uint32_t colour = hover || dragging ? BarHoverColour : BarColour;
+        if (vertical)
+            FilledRect(x, y + barPosition, ScrollBarSize, barLength, colour, colour);
+        else
+            FilledRect(x + barPosition, y, barLength, ScrollBarSize, colour, colour);
     }
 }
 
+void ImGui::PushClipRect(int x, int y, int width, int height)
+{
+    ImGuiContext::ClipRect clip = s_context->clipStack.back();
+    clip.x0 = std::max(clip.x0, x);
+    clip.y0 = std::max(clip.y0, y);
+    clip.x1 = std::max(std::min(clip.x1, x + width), clip.x0);
+    clip.y1 = std::max(std::min(clip.y1, y + height), clip.y0);
+    s_context->clipStack.push_back(clip);
+}
+
+void ImGui::PopClipRect()
+{
+    assert(s_context->clipStack.size() > 1);
+    s_context->clipStack.pop_back();
+}
+
+void ImGui::BeginList(const char* id, int x, int y, int width, int height, int itemCount, int itemHeight, int& first, int& last)
+{
+    assert(id);
+    assert(s_context && s_context->HasStarted());
+    assert(!s_context->inList && !s_context->inTable);
+    assert(itemCount >= 0 && itemHeight > 0);
+
+    const uint32_t BackgroundColour = MAKE_RGB(40, 44, 47);
+    const uint32_t BorderColour = MAKE_RGB(104, 108, 111);
+    const int WheelRows = 3;
+
+    uint32_t listId = GetID(id);
+
+    // The rows show through the inside of the border.
+    int viewX = x + 1;
+    int viewY = y + 1;
+    int viewHeight = std::max(height - 2, 0);
+    int64_t contentHeight = (int64_t)itemCount * itemHeight;
+    int viewWidth = std::max(width - 2 - (contentHeight > viewHeight ? ScrollBarSize : 0), 0);
+
+    float wheel = 0.0f;
+    if (IsMouseOver(x, y, width, height))
+    {
+        s_context->hoverId = listId;
+        wheel = GetMouseWheel() * WheelRows * itemHeight;
+    }
+
+    FilledRect(x, y, width, height, BackgroundColour, BorderColour);
+
+    ImGuiContext::WidgetState& state = s_context->GetState(listId);
+    ScrollBar(listId, true, viewX + viewWidth, viewY, viewHeight, contentHeight, viewHeight, wheel, state.scroll, state.scrollTarget);
+
+    int64_t scroll = (int64_t)state.scroll;
+    first = (int)(scroll / itemHeight);
+    last = (int)std::min((scroll + viewHeight + itemHeight - 1) / itemHeight, (int64_t)itemCount);
+
+    PushClipRect(viewX, viewY, viewWidth, viewHeight);
+    s_context->idStack.push_back(listId);
+
+    s_context->inList = true;
+    s_context->listY = viewY;
+    s_context->listScroll = scroll;
+    s_context->listItemHeight = itemHeight;
+}
+
+int ImGui::GetListItemY(int item)
+{
+    assert(s_context && s_context->inList);
+    return s_context->listY + (int)(((int64_t)item * s_context->listItemHeight) - s_context->listScroll);
+}
+
+void ImGui::EndList()
+{
+    assert(s_context && s_context->inList);
+    PopClipRect();
+    s_context->idStack.pop_back();
+    s_context->inList = false;
+}
+
+void ImGui::BeginTable(const char* id, int x, int y, int width, int height, const ImGuiTableColumn* columns, int columnCount, int rowCount, int rowHeight, int& firstRow, int& lastRow, int& firstColumn, int& lastColumn)
+{
+    assert(id && columns);
+    assert(s_context && s_context->HasStarted());
+    assert(!s_context->inList && !s_context->inTable);
+    assert(columnCount > 0 && rowCount >= 0 && rowHeight > 0);
+
+    const uint32_t BackgroundColour = MAKE_RGB(40, 44, 47);
+    const uint32_t StripeColour = MAKE_RGB(46, 50, 53);
+    const uint32_t BorderColour = MAKE_RGB(104, 108, 111);
+    const uint32_t HeaderColour = MAKE_RGB(32, 50, 77);
+    const uint32_t HeaderBorderColour = MAKE_RGB(68, 79, 103);
+    const uint32_t DividerColour = MAKE_RGB(68, 79, 103);
+    const uint32_t DividerHoverColour = MAKE_RGB(200, 200, 229);
+    const int CellPadding = 4;
+    const int MinColumnWidth = 16;
+    const int GrabWidth = 3;
+    const int WheelRows = 3;
+
+    uint32_t tableId = GetID(id);
+    s_context->idStack.push_back(tableId);
+    Font* font = s_context->font;
+
+    // Column widths come from the widget state: the user's width if they've dragged the column,
+    // otherwise the width asked for, or the header's width measured when the column first appeared.
+    std::vector<int>& columnX = s_context->tableColumnX;
+    columnX.resize(columnCount + 1);
+    columnX[0] = 0;
+    for (int i = 0; i < columnCount; i++)
+    {
+        ImGuiContext::WidgetState& state = s_context->GetState(GetID(columns[i].header));
+        if (state.textWidth < 0)
+            state.textWidth = font->GetStringWidth(columns[i].header);
+        int columnWidth = state.size > 0 ? state.size : columns[i].width > 0 ? columns[i].width : state.textWidth + (CellPadding * 2);
+        columnX[i + 1] = columnX[i] + columnWidth;
+    }
+
+    // The header row stays put vertically and the body scrolls under it, inside the border. The bars
+    // take space from the body only when needed.
+    int viewX = x + 1;
+    int headerY = y + 1;
+    int viewY = headerY + rowHeight;
+    int64_t contentHeight = (int64_t)rowCount * rowHeight;
+    int contentWidth = columnX[columnCount];
+    int viewWidth = std::max(width - 2, 0);
+    int viewHeight = std::max(height - 2 - rowHeight, 0);
+    bool barY = contentHeight > viewHeight;
+    bool barX = contentWidth > viewWidth - (barY ? ScrollBarSize : 0);
+    barY = barY || contentHeight > viewHeight - (barX ? ScrollBarSize : 0);
+    viewWidth = std::max(viewWidth - (barY ? ScrollBarSize : 0), 0);
+    viewHeight = std::max(viewHeight - (barX ? ScrollBarSize : 0), 0);
+
+    // The wheel scrolls rows, or columns with shift held.
+    float wheelX = 0.0f;
+    float wheelY = 0.0f;
+    if (IsMouseOver(x, y, width, height))
+    {
+        s_context->hoverId = tableId;
+        float wheel = GetMouseWheel() * WheelRows * rowHeight;
+        if (IsKeyDown(Pixie::Key_LeftShift) || IsKeyDown(Pixie::Key_RightShift))
+            wheelX = wheel;
+        else
+            wheelY = wheel;
+    }
+
+    FilledRect(x, y, width, height, BackgroundColour, BorderColour);
+
+    ImGuiContext::WidgetState& scrollX = s_context->GetState(GetID("#scrollx"));
+    ScrollBar(GetID("#barx"), false, viewX, viewY + viewHeight, viewWidth, contentWidth, viewWidth, wheelX, scrollX.scroll, scrollX.scrollTarget);
+    int scrollLeft = (int)scrollX.scroll;
+
+    ImGuiContext::WidgetState& scrollY = s_context->GetState(GetID("#scrolly"));
+    ScrollBar(GetID("#bary"), true, viewX + viewWidth, viewY, viewHeight, contentHeight, viewHeight, wheelY, scrollY.scroll, scrollY.scrollTarget);
+    int64_t scrollTop = (int64_t)scrollY.scroll;
+
+    firstRow = (int)(scrollTop / rowHeight);
+    lastRow = (int)std::min((scrollTop + viewHeight + rowHeight - 1) / rowHeight, (int64_t)rowCount);
+
+    // Only the columns that overlap the view. The offsets are sorted, so binary search them.
+    firstColumn = (int)(std::upper_bound(columnX.begin(), columnX.end(), scrollLeft) - columnX.begin()) - 1;
+    firstColumn = std::max(std::min(firstColumn, columnCount), 0);
+    lastColumn = (int)(std::lower_bound(columnX.begin(), columnX.end(), scrollLeft + viewWidth) - columnX.begin());
+    lastColumn = std::min(lastColumn, columnCount);
+
+    s_context->inTable = true;
+    s_context->tableX = viewX - scrollLeft;
+    s_context->tableY = viewY;
+    s_context->tableScroll = scrollTop;
+    s_context->tableRowHeight = rowHeight;
+    s_context->tableColumnCount = columnCount;
+
+    // Headers, with a grab on each resizable column's right edge.
+    PushClipRect(viewX, headerY, viewWidth, rowHeight);
+    for (int i = firstColumn; i < lastColumn; i++)
+    {
+        int cellX = s_context->tableX + columnX[i];
+        int cellWidth = columnX[i + 1] - columnX[i];
+        FilledRect(cellX, headerY, cellWidth, rowHeight, HeaderColour, HeaderBorderColour);
+
+        PushClipRect(cellX + CellPadding, headerY, cellWidth - (CellPadding * 2), rowHeight);
+        Label(columns[i].header, cellX + CellPadding, headerY + ((rowHeight - font->GetCharacterHeight()) >> 1), s_context->defaultTextColour);
+        PopClipRect();
+
+        if (!columns[i].resizable)
+            continue;
+
+        uint32_t grabId = GetID(columns[i].header) ^ 1;
+        int edge = cellX + cellWidth - 1;
+        bool hover = IsMouseOver(edge - GrabWidth, headerY, GrabWidth * 2, rowHeight);
+        if (hover)
+        {
+            s_context->hoverId = grabId;
+            if (HasMouseGoneDown(Pixie::MouseButton_Left))
+                s_context->focusId = grabId;
+        }
+
+        bool dragging = s_context->focusId == grabId && IsMouseDown(Pixie::MouseButton_Left);
+        if (dragging)
+        {
+            ImGuiContext::WidgetState& state = s_context->GetState(GetID(columns[i].header));
+            state.size = std::max(GetMouseX() - cellX + 1, MinColumnWidth);
+        }
+
+        uint32_t colour = hover || dragging ? DividerHoverColour : DividerColour;
+        FilledRect(edge, headerY, 1, rowHeight, colour, colour);
+    }
+    PopClipRect();
+
+    // Stripe every other row, then leave the body clipped for the cells.
+    PushClipRect(viewX, viewY, viewWidth, viewHeight);
+    for (int row = firstRow; row < lastRow; row++)
+    {
+        if (row & 1)
+            FilledRect(viewX, GetTableRowY(row), viewWidth, rowHeight, StripeColour, StripeColour);
+    }
+}
+
+int ImGui::GetTableRowY(int row)
+{
+    assert(s_context && s_context->inTable);
+    return s_context->tableY + (int)(((int64_t)row * s_context->tableRowHeight) - s_context->tableScroll);
+}
+
+void ImGui::TableCell(int row, int column, const char* text)
+{
+    assert(text);
+    assert(s_context && s_context->inTable);
+    assert(column >= 0 && column < s_context->tableColumnCount);
+
+    const int CellPadding = 4;
+
+    // Clip the text to its cell, so long values don't run into the next column.
+    const std::vector<int>& columnX = s_context->tableColumnX;
+    int cellX = s_context->tableX + columnX[column];
+    int cellWidth = columnX[column + 1] - columnX[column];
+    int cellY = GetTableRowY(row);
+    int textY = cellY + ((s_context->tableRowHeight - s_context->font->GetCharacterHeight()) >> 1);
+
+    PushClipRect(cellX + CellPadding, cellY, cellWidth - (CellPadding * 2), s_context->tableRowHeight);
+    Label(text, cellX + CellPadding, textY, s_context->defaultTextColour);
+    PopClipRect();
+}
+
+void ImGui::EndTable()
+{
+    assert(s_context && s_context->inTable);
+    PopClipRect();
+    s_context->idStack.pop_back();
+    s_context->inTable = false;
+}
+
+void ImGui::Rect(int x, int y, int width, int height, uint32_t borderColour)
+{
+    assert(s_context && s_context->HasStarted());
+    s_context->AddRect(ImGuiContext::Command_Rect, x, y, width, height, borderColour, borderColour);
+}
+
 void ImGui::FilledRect(int x, int y, int width, int height, uint32_t colour, uint32_t borderColour)
 {
-    assert(s_state.HasStarted());
-    Window* window = s_state.window;
-    uint32_t* pixels = window->GetPixels();
-    int windowWidth = window->GetWidth();
-    int windowHeight = window->GetHeight();
+    assert(s_context && s_context->HasStarted());
+    s_context->AddRect(ImGuiContext::Command_FilledRect, x, y, width, height, colour, borderColour);
+}
+
+void ImGuiContext::AddRect(int type, int x, int y, int width, int height, uint32_t colour, uint32_t borderColour)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    // Merge solid rects that continue the previous one, e.g. the segments of a bar. Only when
+    // neither is clipped, as the merged rect is drawn whole.
+    const ClipRect& clip = clipStack.back();
+    bool inside = x >= clip.x0 && y >= clip.y0 && x + width <= clip.x1 && y + height <= clip.y1;
+    if (type == Command_FilledRect && colour == borderColour && inside && !commands.empty())
+    {
+        Command& last = commands.back();
+        bool lastWhole = last.clipX0 == last.x && last.clipY0 == last.y && last.clipX1 == last.x + last.width && last.clipY1 == last.y + last.height;
+        if (last.type == Command_FilledRect && last.colour == colour && last.borderColour == colour && lastWhole)
+        {
+            if (last.y == y && last.height == height && last.x + last.width == x)
+            {
+                last.width += width;
+                last.clipX1 = x + width;
+                return;
+            }
+            if (last.x == x && last.width == width && last.y + last.height == y)
+            {
+                last.height += height;
+                last.clipY1 = y + height;
+                return;
+            }
+        }
+    }
+
+    Command command;
+    command.type = type;
+    command.x = x;
+    command.y = y;
+    command.width = width;
+    command.height = height;
+    command.colour = colour;
+    command.borderColour = borderColour;
+    command.text = 0;
+    AddCommand(command);
+}
+
+void ImGuiContext::AddText(const char* string, int x, int y, uint32_t colour)
+{
+    int length = (int)strlen(string);
+    if (length == 0)
+        return;
+
+    Command command;
+    command.type = Command_Text;
+    command.x = x;
+    command.y = y;
+    command.width = font->GetStringWidth(string);
+    command.height = font->GetCharacterHeight();
+    command.colour = colour;
+    command.borderColour = colour;
+    command.text = (uint32_t)text.size();
+    if (!AddCommand(command))
+        return;
+    text.insert(text.end(), string, string + length + 1);
+}
 
-    pixels += x + (y*windowWidth);
+bool ImGuiContext::AddCommand(Command& command)
+{
+    const ClipRect& clip = clipStack.back();
+    command.clipX0 = std::max(command.x, clip.x0);
+    command.clipY0 = std::max(command.y, clip.y0);
+    command.clipX1 = std::min(command.x + command.width, clip.x1);
+    command.clipY1 = std::min(command.y + command.height, clip.y1);
+    if (command.clipX0 >= command.clipX1 || command.clipY0 >= command.clipY1)
+        return false;
+
+    commands.push_back(command);
+    return true;
+}
 
-    for (int j = 0, ypos = y; j < height && ypos < windowHeight; j++, ypos++)
+static void DrawRect(uint32_t* pixels, int pitch, int clipX0, int clipY0, int clipX1, int clipY1, int x, int y, int width, int height, uint32_t borderColour)
+{
+    int x0 = std::max(x, clipX0);
+    int y0 = std::max(y, clipY0);
+    int x1 = std::min(x + width, clipX1);
+    int y1 = std::min(y + height, clipY1);
+    int right = x + width - 1;
+    int bottom = y + height - 1;
+
+    if (y == y0)
+        FillSpan(pixels + x0 + (y*pitch), x1 - x0, borderColour);
+    if (bottom < y1 && bottom != y)
+        FillSpan(pixels + x0 + (bottom*pitch), x1 - x0, borderColour);
+
+    for (int ypos = y0; ypos < y1; ypos++)
     {
-        for (int i = 0, xpos = x; i < width; i++, xpos++)
+        uint32_t* row = pixels + (ypos*pitch);
+        if (x == x0)
+            row[x] = borderColour;
+        if (right < x1)
+            row[right] = borderColour;
+    }
+}
+
+static void DrawFilledRect(uint32_t* pixels, int pitch, int clipX0, int clipY0, int clipX1, int clipY1, int x, int y, int width, int height, uint32_t colour, uint32_t borderColour)
+{
+    int x0 = std::max(x, clipX0);
+    int y0 = std::max(y, clipY0);
+    int x1 = std::min(x + width, clipX1);
+    int y1 = std::min(y + height, clipY1);
+
+    if (colour == borderColour)
+    {
+        FillBlock(pixels + x0 + (y0*pitch), pitch, x1 - x0, y1 - y0, colour);
+        return;
+    }
+
+    // The interior, excluding the left and right border columns.
+    int innerX0 = std::max(x + 1, x0);
+    int innerX1 = std::min(x + width - 1, x1);
+    int right = x + width - 1;
+    int bottom = y + height - 1;
+
+    for (int ypos = y0; ypos < y1; ypos++)
+    {
+        uint32_t* row = pixels + (ypos*pitch);
+        if (ypos == y || ypos == bottom)
+        {
+            FillSpan(row + x0, x1 - x0, borderColour);
+            continue;
+        }
+
+        if (x == x0)
+            row[x] = borderColour;
+        if (innerX0 < innerX1)
+            FillSpan(row + innerX0, innerX1 - innerX0, colour);
+        if (right < x1)
+            row[right] = borderColour;
+    }
+}
+
+static void DrawCheck(uint32_t* pixels, int width, int height, int clipX0, int clipY0, int clipX1, int clipY1, int x, int y, int size, uint32_t colour)
+{
+    // Two diagonals, corner to corner.
+    DrawTarget target(pixels, width, height);
+    target.SetClip(clipX0, clipY0, clipX1 - clipX0, clipY1 - clipY0);
+    DrawLine(target, x, y, x + size - 1, y + size - 1, colour);
+    DrawLine(target, x + size - 1, y, x, y + size - 1, colour);
+}
+
+void ImGuiContext::Rasterize(const int* bin, int count, int clipX0, int clipY0, int clipX1, int clipY1) const
+{
+    // Everything under the last filled rect that covers the whole clip rect would be overdrawn, so
+    // start from there.
+    int first = 0;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        const Command& command = commands[bin[i]];
+        if (command.type == Command_FilledRect && command.clipX0 <= clipX0 && command.clipY0 <= clipY0 &&
+            command.clipX1 >= clipX1 && command.clipY1 >= clipY1)
         {
-            if (xpos < 0 || xpos >= windowWidth || ypos < 0 || ypos >= windowHeight)
-                continue;
-            *pixels = (i == 0 || i == width - 1 || j == 0 || j == height - 1) ? borderColour : colour;
-            pixels++;
+            first = i;
+            break;
         }
+    }
 
-        pixels += windowWidth - width;
+    for (int i = first; i < count; i++)
+    {
+        const Command& command = commands[bin[i]];
+        int x0 = std::max(clipX0, command.clipX0);
+        int y0 = std::max(clipY0, command.clipY0);
+        int x1 = std::min(clipX1, command.clipX1);
+        int y1 = std::min(clipY1, command.clipY1);
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+
+        switch (command.type)
+        {
+            case Command_FilledRect:
+                DrawFilledRect(pixels, width, x0, y0, x1, y1, command.x, command.y, command.width, command.height, command.colour, command.borderColour);
+                break;
+            case Command_Rect:
+                DrawRect(pixels, width, x0, y0, x1, y1, command.x, command.y, command.width, command.height, command.colour);
+                break;
+            case Command_Text:
+                font->DrawColour(&text[command.text], command.x, command.y, command.colour, pixels, width, x0, y0, x1, y1);
+                break;
+            case Command_Check:
+                DrawCheck(pixels, width, height, x0, y0, x1, y1, command.x, command.y, command.width, command.colour);
+                break;
+        }
     }
 }
 
+static uint64_t HashValue(uint64_t hash, uint64_t value)
+{
+    // FNV-1a, a word at a time.
+    return (hash ^ value) * 0x100000001b3ull;
+}
+
+void ImGuiContext::RasterizeTiles()
+{
+    // Enough tiles to be worth waking the job pool for.
+    const int ParallelTileCount = 8;
+
+    JobPool& jobPool = JobPool::GetDefault();
+
+    // With no one to share the work and no tiles to skip, one pass over the whole target is cheapest.
+    if (!retained && jobPool.GetThreadCount() == 0)
+    {
+        binCommands.resize(commands.size());
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            binCommands[i] = (int)i;
+            const Command& command = commands[i];
+            Invalidate(command.clipX0, command.clipY0, command.clipX1 - command.clipX0, command.clipY1 - command.clipY0);
+        }
+        if (!commands.empty())
+            Rasterize(&binCommands[0], (int)commands.size(), 0, 0, width, height);
+        return;
+    }
+
+    int tilesX = (width + TileSize - 1) / TileSize;
+    int tilesY = (height + TileSize - 1) / TileSize;
+    int numTiles = tilesX * tilesY;
+
+    // Bin the commands: count the commands touching each tile, turn the counts into offsets, then
+    // fill in the command indices. Each bin stays in drawing order.
+    binStarts.assign(numTiles + 1, 0);
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        const Command& command = commands[i];
+        int tx0 = command.clipX0 / TileSize;
+        int ty0 = command.clipY0 / TileSize;
+        int tx1 = (command.clipX1 - 1) / TileSize;
+        int ty1 = (command.clipY1 - 1) / TileSize;
+        for (int ty = ty0; ty <= ty1; ty++)
+        {
+            for (int tx = tx0; tx <= tx1; tx++)
+                binStarts[(ty * tilesX) + tx + 1]++;
+        }
+    }
+    for (int tile = 0; tile < numTiles; tile++)
+        binStarts[tile + 1] += binStarts[tile];
+
+    binCommands.resize(binStarts[numTiles]);
+    drawTiles.assign(binStarts.begin(), binStarts.end() - 1);
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        const Command& command = commands[i];
+        int tx0 = command.clipX0 / TileSize;
+        int ty0 = command.clipY0 / TileSize;
+        int tx1 = (command.clipX1 - 1) / TileSize;
+        int ty1 = (command.clipY1 - 1) / TileSize;
+        for (int ty = ty0; ty <= ty1; ty++)
+        {
+            for (int tx = tx0; tx <= tx1; tx++)
+                binCommands[drawTiles[(ty * tilesX) + tx]++] = (int)i;
+        }
+    }
+
+    drawTiles.clear();
+    if (retained)
+    {
+        // A different target has nothing to compare against.
+        if (pixels != retainedPixels || width != retainedWidth || height != retainedHeight || (int)lastTileHashes.size() != numTiles)
+        {
+            retainedPixels = pixels;
+            retainedWidth = width;
+            retainedHeight = height;
+            redrawAll = true;
+        }
+
+        // Each tile hashes the background, the font and its commands in drawing order, and is drawn
+        // if that differs from last frame.
+        uint64_t seed = HashValue(HashValue(0xcbf29ce484222325ull, backgroundColour), (uint64_t)(uintptr_t)font);
+        tileHashes.resize(numTiles);
+        for (int tile = 0; tile < numTiles; tile++)
+        {
+            uint64_t tileHash = seed;
+            for (int i = binStarts[tile]; i < binStarts[tile + 1]; i++)
+            {
+                const Command& command = commands[binCommands[i]];
+                tileHash = HashValue(tileHash, command.type);
+                tileHash = HashValue(tileHash, ((uint64_t)(uint32_t)command.x << 32) | (uint32_t)command.y);
+                tileHash = HashValue(tileHash, ((uint64_t)(uint32_t)command.width << 32) | (uint32_t)command.height);
+                tileHash = HashValue(tileHash, ((uint64_t)command.colour << 32) | command.borderColour);
+                tileHash = HashValue(tileHash, ((uint64_t)(uint32_t)command.clipX0 << 32) | (uint32_t)command.clipY0);
+                tileHash = HashValue(tileHash, ((uint64_t)(uint32_t)command.clipX1 << 32) | (uint32_t)command.clipY1);
+                if (command.type == Command_Text)
+                {
+                    for (const char* c = &text[command.text]; *c; c++)
+                        tileHash = HashValue(tileHash, (uint8_t)*c);
+                }
+            }
+
+            tileHashes[tile] = tileHash;
+            if (redrawAll || tileHash != lastTileHashes[tile])
+                drawTiles.push_back(tile);
+        }
+
+        tileHashes.swap(lastTileHashes);
+        redrawAll = false;
+    }
+    else
+    {
+        // Tiles without commands have nothing to draw.
+        for (int tile = 0; tile < numTiles; tile++)
+        {
+            if (binStarts[tile] != binStarts[tile + 1])
+                drawTiles.push_back(tile);
+        }
+    }
+
+    // Tiles don't overlap and each draws its commands in order, so the result is the same however
+    // the tiles are spread over threads.
+    auto drawTile = [this, tilesX](int index)
+    {
+        int tile = drawTiles[index];
+        int x0 = (tile % tilesX) * TileSize;
+        int y0 = (tile / tilesX) * TileSize;
+        int x1 = std::min(x0 + TileSize, width);
+        int y1 = std::min(y0 + TileSize, height);
+        if (retained)
+            FillBlock(pixels + x0 + (y0 * width), width, x1 - x0, y1 - y0, backgroundColour);
+        Rasterize(&binCommands[binStarts[tile]], binStarts[tile + 1] - binStarts[tile], x0, y0, x1, y1);
+    };
+
+    int numDrawTiles = (int)drawTiles.size();
+    if (numDrawTiles >= ParallelTileCount)
+    {
+        jobPool.ParallelFor(numDrawTiles, drawTile);
+    }
+    else
+    {
+        for (int i = 0; i < numDrawTiles; i++)
+            drawTile(i);
+    }
+
+    if (retained)
+    {
+        for (int i = 0; i < numDrawTiles; i++)
+        {
+            int tile = drawTiles[i];
+            Invalidate((tile % tilesX) * TileSize, (tile / tilesX) * TileSize, TileSize, TileSize);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            const Command& command = commands[i];
+            Invalidate(command.clipX0, command.clipY0, command.clipX1 - command.clipX0, command.clipY1 - command.clipY0);
+        }
+    }
+}
@@ -1,19 +1,209 @@
 #pragma once
 
 #include <stdint.h>
+#include <vector>
 #include "core.h"
 
 namespace Pixie
 {
     class Window;
     class Font;
+    class PlotBuffer;
+
+    // Everything ImGui keeps from frame to frame (focus, the text cursor, key repeat) and between
+    // Begin and End. Give each window, or offscreen target, its own context. A context must only
+    // be used by one thread at a time, but different contexts can be used on different threads at once.
+    class ImGuiContext
+    {
+        public:
+            ImGuiContext();
+
+            // Lets ImGui keep the target between frames. End fills it with the background colour under
+            // the widgets, and after the first frame only redraws and invalidates the tiles whose
+            // commands changed, so an unchanged UI costs almost nothing. Only use this when nothing
+            // else draws to the target.
+            void SetRetained(bool enabled, uint32_t backgroundColour = 0);
+            bool IsRetained() const { return retained; }
+
+            // Makes the next End redraw every tile, e.g. after drawing over the target directly.
+            void Redraw() { redrawAll = true; }
+
+        private:
+            friend class ImGui;
+
+            enum
+            {
+                TileSize = 64
+            };
+
+            enum Flags
+            {
+                Flags_Started = 1 << 0,
+            };
+
+            enum CommandType
+            {
+                Command_FilledRect,
+                Command_Rect,
+                Command_Text,
+                Command_Check,
+            };
+
+            // A drawing operation recorded by a widget and rasterized at End.
+            struct Command
+            {
+                int type;
+                int x;
+                int y;
+                int width;
+                int height;
+                uint32_t colour;
+                uint32_t borderColour;
+                // Offset of the null terminated string in the text arena.
+                uint32_t text;
+                // The part that's drawn: the command's rect, cut down to the clip rect and the target.
+                int clipX0;
+                int clipY0;
+                int clipX1;
+                int clipY1;
+            };
+
+            struct ClipRect
+            {
+                int x0;
+                int y0;
+                int x1;
+                int y1;
+            };
+
+            // What ImGui remembers about a widget between frames, found by the widget's ID.
+            struct WidgetState
+            {
+                // 0 for an empty slot.
+                uint32_t id;
+                uint32_t lastFrame;
+                // Width of the widget's label in the current font, or -1 if not measured yet.
+                int textWidth;
+                // Scroll position in pixels, and where it's heading.
+                double scroll;
+                double scrollTarget;
+                // Size the user has given the widget, e.g. by dragging a column edge, or -1.
+                int size;
+            };
+
+            bool HasStarted() const { return (flags & Flags_Started) != 0; }
+
+            // Returns the state for the widget, adding it if it's new.
+            WidgetState& GetState(uint32_t id);
+            // Rebuilds the state table with the given capacity, dropping widgets not seen since oldestFrame.
+            void RebuildStates(int capacity, uint32_t oldestFrame);
+
+            void AddRect(int type, int x, int y, int width, int height, uint32_t colour, uint32_t borderColour);
+            void AddText(const char* text, int x, int y, uint32_t colour);
+            // Clips the command to the current clip rect and adds it, unless nothing of it is left.
+            bool AddCommand(Command& command);
+
+            // Draws the listed commands, clipped to [clipX0, clipX1) x [clipY0, clipY1).
+            void Rasterize(const int* bin, int count, int clipX0, int clipY0, int clipX1, int clipY1) const;
+            // Sorts the commands into the tiles they touch and draws the tiles that need it, across
+            // the job pool when there are enough. In retained mode only tiles whose commands changed
+            // since last frame are drawn.
+            void RasterizeTiles();
+
+            int flags;
+            uint32_t hoverId;
+            uint32_t focusId;
+            int keyboardCursorPosition;
+            float keyRepeatTimer;
+            float keyRepeatTime;
+            float cursorBlinkTimer;
+            uint32_t defaultTextColour;
+
+            // Seeds for widget IDs. The bottom one is the context's own.
+            std::vector<uint32_t> idStack;
+            // Drawing is clipped to the top rect. The bottom one is the whole target.
+            std::vector<ClipRect> clipStack;
+
+            // The list between BeginList and EndList.
+            bool inList;
+            int listY;
+            int64_t listScroll;
+            int listItemHeight;
+
+            // The table between BeginTable and EndTable. Column i spans tableColumnX[i] up to
+            // tableColumnX[i + 1], from tableX.
+            bool inTable;
+            int tableX;
+            int tableY;
+            int64_t tableScroll;
+            int tableRowHeight;
+            int tableColumnCount;
+            std::vector<int> tableColumnX;
+
+            // An open addressing hash table (linear probing, capacity a power of two) of widget state.
+            std::vector<WidgetState> states;
+            int numStates;
+            uint32_t frame;
+            // The font the cached text widths were measured with.
+            Font* stateFont;
+
+            // What's being drawn to, between Begin and End.
+            Font* font;
+            uint32_t* pixels;
+            int width;
+            int height;
+
+            // This frame's commands and the strings they draw. Cleared by Begin, but they keep their
+            // memory, so a steady UI stops allocating after the first frame.
+            std::vector<Command> commands;
+            std::vector<char> text;
+
+            // The commands touching each tile are binCommands[binStarts[tile]] up to binStarts[tile + 1].
+            std::vector<int> binStarts;
+            std::vector<int> binCommands;
+            std::vector<int> drawTiles;
+
+            bool retained;
+            bool redrawAll;
+            uint32_t backgroundColour;
+            // The target the tile hashes were made for.
+            uint32_t* retainedPixels;
+            int retainedWidth;
+            int retainedHeight;
+            std::vector<uint64_t> tileHashes;
+            std::vector<uint64_t> lastTileHashes;
+    };
+
+    struct ImGuiTableColumn
+    {
+        const char* header;
+        // Width in pixels, or 0 to fit the header.
+        int width;
+        // Whether the column's right edge can be dragged to resize it.
+        bool resizable;
+    };
 
     class ImGui
     {
         public:
-            static void Begin(Window* window, Font* font);
+            // Starts building UI for the window. The context is bound to the calling thread until End.
+            // Without one, each thread uses its own default context.
+            static void Begin(Window* window, Font* font, ImGuiContext* context = 0);
+            // Starts building UI into a width x height buffer of pixels that isn't a window, e.g. a
+            // Buffer. There's no input, so widgets are drawn but can't be interacted with.
+            static void Begin(uint32_t* pixels, int width, int height, Font* font, ImGuiContext* context = 0);
             static void End();
 
+            // Widget IDs are hashed from their label, or from the value they edit for inputs and
+            // sliders, mixed with the ID on top of this stack. Push something unique (a loop index
+            // or an object pointer) around widgets whose labels repeat.
+            static void PushID(const char* id);
+            static void PushID(const void* id);
+            static void PushID(int id);
+            static void PopID();
+            static uint32_t GetID(const char* id);
+            static uint32_t GetID(const void* id);
+
             // UI widgets
             static void Label(const char* text, int x, int y, uint32_t colour);
             static bool Button(const char* label, int x, int y, int width, int height);
@@ -23,8 +213,48 @@ namespace Pixie
             static void SliderFloat(float &value, float min, float max, int x, int y, int width, int height);
             static void SliderInt(int &value, int min, int max, int x, int y, int width, int height);
 
+            // A scrolling list of itemCount rows, each itemHeight pixels tall. BeginList sets first and
+            // last to the visible rows, last not included. Draw just those, at GetListItemY(row), then
+            // call EndList. Drawing in between is clipped to the list, so the cost doesn't depend on
+            // itemCount. Scrolls with the mouse wheel or by dragging the bar on the right.
+            static void BeginList(const char* id, int x, int y, int width, int height, int itemCount, int itemHeight, int& first, int& last);
+            static int GetListItemY(int item);
+            static void EndList();
+
+            // A scrolling table of rowCount rows under a header. Like lists, BeginTable sets the range
+            // of visible rows, and of visible columns, last not included. Fill just those cells with
+            // TableCell, then call EndTable. Text is clipped to its cell. Column widths are measured
+            // once and kept, as are widths the user drags to, so headers must be unique. The wheel
+            // scrolls rows, or columns with shift held.
+            static void BeginTable(const char* id, int x, int y, int width, int height, const ImGuiTableColumn* columns, int columnCount, int rowCount, int rowHeight, int& firstRow, int& lastRow, int& firstColumn, int& lastColumn);
+            static void TableCell(int row, int column, const char* text);
+            static int GetTableRowY(int row);
+            static void EndTable();
+
+            // Plot the samples in a buffer, one pixel column per run of samples however many there
+            // are. Each column spans the smallest to largest sample of its run, so spikes never get
+            // lost. The vertical range is minValue to maxValue, or fits the samples if minValue
+            // isn't below maxValue.
+            static void PlotLines(const PlotBuffer& buffer, int x, int y, int width, int height, float minValue = 0.0f, float maxValue = 0.0f);
+            static void PlotHistogram(const PlotBuffer& buffer, int x, int y, int width, int height, float minValue = 0.0f, float maxValue = 0.0f);
+
             // Basic drawing
             static void Rect(int x, int y, int width, int height, uint32_t borderColour);
             static void FilledRect(int x, int y, int width, int height, uint32_t colour, uint32_t borderColour);
+
+        private:
+            enum
+            {
+                ScrollBarSize = 8
+            };
+
+            static bool IsMouseOver(int x, int y, int width, int height);
+            // Handles and draws a scroll bar along a track of length pixels, moving scroll towards
+            // scrollTarget, which the wheel (in pixels) and dragging the bar move.
+            static void ScrollBar(uint32_t id, bool vertical, int x, int y, int length, int64_t contentLength, int viewLength, float wheel, double& scroll, double& scrollTarget);
+            static void Plot(const PlotBuffer& buffer, int x, int y, int width, int height, float minValue, float maxValue, bool histogram);
+            static void PushClipRect(int x, int y, int width, int height);
+            static void PopClipRect();
+            static bool ButtonBehaviour(uint32_t id, const char* label, int x, int y, int width, int height);
     };
 }
@@ -0,0 +1,175 @@
+#include "jobs.h"
+#include <assert.h>
+#include <algorithm>
+
+using namespace Pixie;
+
+enum
+{
+    MaxSlots = 64
+};
+
+struct JobPool::Batch
+{
+    const std::function<void(int)>* job;
+    int numSlots;
+    // Slots handed out and threads still inside the batch, guarded by the pool mutex.
+    int joined;
+    int active;
+    // Each slot's remaining items, with the front in the low 32 bits and the end in the high 32 bits,
+    // so the owner and thieves agree on who took what with a single compare and swap.
+    std::atomic<uint64_t> ranges[MaxSlots];
+};
+
+static bool TakeFront(std::atomic<uint64_t>& range, int& item)
+{
+    uint64_t value = range.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        uint32_t front = (uint32_t)value;
+        uint32_t end = (uint32_t)(value >> 32);
+        if (front >= end)
+            return false;
+        if (range.compare_exchange_weak(value, ((uint64_t)end << 32) | (front + 1), std::memory_order_acquire))
+        {
+            item = (int)front;
+            return true;
+        }
+    }
+}
+
+static bool TakeBack(std::atomic<uint64_t>& range, int& item)
+{
+    uint64_t value = range.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        uint32_t front = (uint32_t)value;
+        uint32_t end = (uint32_t)(value >> 32);
+        if (front >= end)
+            return false;
+        if (range.compare_exchange_weak(value, ((uint64_t)(end - 1) << 32) | front, std::memory_order_acquire))
+        {
+            item = (int)end - 1;
+            return true;
+        }
+    }
+}
+
+JobPool::JobPool(int numThreads)
+{
+    m_stopping = false;
+    for (int i = 0; i < numThreads; i++)
+        m_threads.push_back(std::thread(&JobPool::WorkerThread, this));
+}
+
+JobPool::~JobPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_batchAdded.notify_all();
+
+    for (size_t i = 0; i < m_threads.size(); i++)
+        m_threads[i].join();
+}
+
+JobPool& JobPool::GetDefault()
+{
+    static JobPool pool(std::max((int)std::thread::hardware_concurrency() - 1, 0));
+    return pool;
+}
+
+void JobPool::ParallelFor(int count, const std::function<void(int)>& job)
+{
+    if (count <= 0)
+        return;
+
+    int numSlots = std::min(std::min(count, GetThreadCount() + 1), (int)MaxSlots);
+    if (numSlots == 1)
+    {
+        for (int i = 0; i < count; i++)
+            job(i);
+        return;
+    }
+
+    Batch batch;
+    batch.job = &job;
+    batch.numSlots = numSlots;
+    batch.joined = 1;
+    batch.active = 1;
+    for (int slot = 0; slot < numSlots; slot++)
+    {
+        uint64_t front = ((uint64_t)count * slot) / numSlots;
+        uint64_t end = ((uint64_t)count * (slot + 1)) / numSlots;
+        batch.ranges[slot].store((end << 32) | front, std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_batches.push_back(&batch);
+    }
+    m_batchAdded.notify_all();
+
+    // The caller takes the first slot, then helps with the rest.
+    RunSlot(&batch, 0);
+
+    // Every item has been taken. Stop new threads joining and wait for the ones still working.
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::vector<Batch*>::iterator it = std::find(m_batches.begin(), m_batches.end(), &batch);
+    if (it != m_batches.end())
+        m_batches.erase(it);
+    batch.active--;
+    m_batchLeft.wait(lock, [&batch]() { return batch.active == 0; });
+}
+
+void JobPool::RunSlot(Batch* batch, int slot)
+{
+    const std::function<void(int)>& job = *batch->job;
+    int item;
+
+    while (TakeFront(batch->ranges[slot], item))
+        job(item);
+
+    // Steal from the back of the other ranges, nearest neighbour first.
+    for (int i = 1; i < batch->numSlots; i++)
+    {
+        std::atomic<uint64_t>& range = batch->ranges[(slot + i) % batch->numSlots];
+        while (TakeBack(range, item))
+            job(item);
+    }
+}
+
+void JobPool::WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        Batch* batch = 0;
+        m_batchAdded.wait(lock, [this, &batch]()
+        {
+            for (size_t i = 0; i < m_batches.size(); i++)
+            {
+                if (m_batches[i]->joined < m_batches[i]->numSlots)
+                {
+                    batch = m_batches[i];
+                    return true;
+                }
+            }
+            return m_stopping;
+        });
+
+        if (!batch)
+            return;
+
+        int slot = batch->joined++;
+        batch->active++;
+        lock.unlock();
+
+        RunSlot(batch, slot);
+
+        lock.lock();
+        if (--batch->active == 0)
+            m_batchLeft.notify_all();
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Pixie
+{
+    // A fixed set of worker threads that run ParallelFor loops. Each loop's items are split into
+    // one range per thread. A thread works through its own range from the front and, once that's
+    // empty, steals from the back of the others, so uneven items still finish together.
+    class JobPool
+    {
+        public:
+            // Starts numThreads workers. The thread calling ParallelFor works too.
+            JobPool(int numThreads);
+            ~JobPool();
+
+            // Calls job(i) for every i in [0, count) and returns once they've all finished. Several
+            // threads can run loops on the same pool at once.
+            void ParallelFor(int count, const std::function<void(int)>& job);
+
+            int GetThreadCount() const;
+
+            // A pool with a worker per core, besides the calling one, started on first use.
+            static JobPool& GetDefault();
+
+        private:
+            struct Batch;
+
+            void WorkerThread();
+            static void RunSlot(Batch* batch, int slot);
+
+            std::vector<std::thread> m_threads;
+            std::vector<Batch*> m_batches;
+            bool m_stopping;
+
+            std::mutex m_mutex;
+            std::condition_variable m_batchAdded;
+            std::condition_variable m_batchLeft;
+    };
+
+    inline int JobPool::GetThreadCount() const
+    {
+        return (int)m_threads.size();
+    }
+}
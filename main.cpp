@@ -1,30 +1,28 @@
 ﻿#include "pixie.h"
 #include "font.h"
 #include "imgui.h"
+#include "draw.h"
 #include "buffer.h"
 #include "pixie_config.h"
 #include <string.h>
 #include <stdio.h>
 #include <algorithm>
+#include <stdlib.h>
+#if PIXIE_PLATFORM_HEADLESS
+#include <chrono>
+#endif
 
 static const TCHAR* WindowTitle = TEXT("Hello, World!");
 static const int WindowWidth = 640;
 static const int WindowHeight = 400;
 
-static void draw(int x, int y, uint32_t* pixels)
-{
-    for (int i = x; i < x+4; i++)
-    {
-        for (int j = y; j < y+4; j++)
-        {
-            if (i < WindowWidth && j < WindowHeight)
-            {
-                int index = (i + (j * WindowWidth));
-                pixels[index] = MAKE_RGB(0, 0, 255);
-            }
-        }
-    }
-}
+#if PIXIE_PLATFORM_HEADLESS
+// With no display the demo runs as a throughput benchmark for this many frames, or argv[1] if
+// it's a positive number. Given an encoder command as argv[2], e.g. "ffmpeg -i - demo.mp4", the
+// frames are piped into it, which also checks the demo carries on if the encoder exits early
+// (try "true").
+static const int DefaultBenchmarkFrames = 1000;
+#endif
 
 int main(int argc, char** argv)
 {
@@ -46,6 +44,17 @@ int main(int argc, char** argv)
 
     uint32_t* pixels = window.GetPixels();
 
+#if PIXIE_PLATFORM_HEADLESS
+    int benchmarkFrames = argc > 1 ? atoi(argv[1]) : DefaultBenchmarkFrames;
+    if (benchmarkFrames < 1)
+        benchmarkFrames = DefaultBenchmarkFrames;
+    int frame = 0;
+    window.SetFixedDelta(1.0f / 60.0f);
+    if (argc > 2 && !window.StartRecording(argv[2], Pixie::RecordingFormat_Pipe, Pixie::RecordingPolicy_Block))
+        printf("pixie: failed to start recording to %s\n", argv[2]);
+    auto benchmarkStart = std::chrono::steady_clock::now();
+#endif
+
     float fvalue = 0;
     int ivalue = 0;
     const float SPEED = 100.0f;
@@ -56,6 +65,12 @@ int main(int argc, char** argv)
 
     while (!window.HasKeyGoneUp(Pixie::Key_Escape))
     {
+#if PIXIE_PLATFORM_HEADLESS
+        if (frame >= benchmarkFrames)
+            break;
+        frame++;
+#endif
+
         Pixie::ImGui::Begin(&window, &font);
 
         float delta = window.GetDelta();
@@ -84,7 +99,7 @@ int main(int argc, char** argv)
             yadd = SPEED;
         }
 
-        memset(pixels, 0, WindowWidth * WindowHeight * sizeof(uint32_t));
+        window.Clear(MAKE_RGB(0, 0, 0));
 
         int cx = 0, cy = 0;
         for (int i = 0; i < 256; i++)
@@ -106,7 +121,7 @@ int main(int argc, char** argv)
             font.Draw(buf, 10, 90, &window);
         }
 
-        draw((int)x, (int)y, pixels);
+        Pixie::FillCircle(Pixie::DrawTarget(pixels, WindowWidth, WindowHeight), (int)x, (int)y, 3, MAKE_RGB(0, 0, 255));
 
 
         Pixie::ImGui::FilledRect(10, 240, 100, 100, MAKE_RGB(255, 0, 0), MAKE_RGB(128, 0, 0));
@@ -127,6 +142,23 @@ int main(int argc, char** argv)
         static bool checked = false;
         checked = Pixie::ImGui::Checkbox("Do the thing", checked, 100, 210);
 
+        static bool capFrameRate = false;
+        bool cap = Pixie::ImGui::Checkbox("Cap at 60fps", capFrameRate, 460, 210);
+        if (cap != capFrameRate)
+        {
+            capFrameRate = cap;
+            window.SetTargetFrameRate(capFrameRate ? 60.0f : 0.0f);
+        }
+
+        if (capFrameRate)
+        {
+            char statsText[64];
+            sprintf_s(statsText, sizeof(statsText), "missed %u", window.GetMissedFrameCount());
+            Pixie::ImGui::Label(statsText, 460, 234, MAKE_RGB(200, 200, 200));
+            sprintf_s(statsText, sizeof(statsText), "p99 jitter %.2fms", window.GetFrameJitter(99.0f) * 1000.0f);
+            Pixie::ImGui::Label(statsText, 460, 250, MAKE_RGB(200, 200, 200));
+        }
+
         static int selection = 0;
         if (Pixie::ImGui::RadioButton("Banana", selection == 0, 300, 210))
             selection = 0;
@@ -175,6 +207,14 @@ int main(int argc, char** argv)
             break;
     }
 
+#if PIXIE_PLATFORM_HEADLESS
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchmarkStart).count();
+    // Report the frames actually rendered, which can be fewer if the window closed early.
+    if (frame > 0)
+        printf("%d frames in %.3fs: %.1f frames/s, %.3fms/frame\n", frame, seconds, frame / seconds, 1000.0 * seconds / frame);
+    window.StopRecording();
+#endif
+
     window.Close();
 
     printf("done\n");
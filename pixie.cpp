@@ -1,7 +1,11 @@
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
 #include "pixie.h"
+#include "recorder.h"
+#include "span.h"
 #include <assert.h>
+#include <algorithm>
 
 using namespace Pixie;
 
@@ -9,12 +13,26 @@ Window::Window()
 {
     m_keyCallback = NULL;
     m_delta = 0.0f;
+    m_fixedDelta = 0.0f;
     m_pixels = 0;
+    m_ownsPixels = true;
+    m_numDirtyRects = 0;
+    m_presentDirtyOnly = false;
+    m_updateMode = UpdateMode_Poll;
+    m_updateTimeoutMs = -1;
+    m_targetFrameRate = 0.0f;
+    m_frameDeadline = 0;
+    m_sleepOvershoot = 0;
+    m_missedFrameCount = 0;
+    m_frameJitterCount = 0;
+    m_recorder = 0;
+    m_window = 0;
     m_scale = 1;
 
     assert(sizeof(m_mouseButtonDown) == sizeof(m_lastMouseButtonDown));
     memset(m_mouseButtonDown, 0, sizeof(m_mouseButtonDown));
     memset(m_lastMouseButtonDown, 0, sizeof(m_lastMouseButtonDown));
+    m_mouseWheel = 0.0f;
 
     memset(m_inputCharacters, 0, sizeof(m_inputCharacters));
     assert(sizeof(m_keyDown) == sizeof(m_lastKeyDown));
@@ -30,7 +48,11 @@ Window::Window()
 
 Window::~Window()
 {
-    delete[] m_pixels;
+    StopRecording();
+
+    // The platform may have replaced the buffer with memory it manages itself (e.g. an XShm segment).
+    if (m_ownsPixels)
+        delete[] m_pixels;
 }
 
 bool Window::Open(const TCHAR* title, int width, int height, bool fullscreen /*= false*/, bool maintainAspectRatio /*= false*/, int scale /*= 1*/)
@@ -44,6 +66,10 @@ bool Window::Open(const TCHAR* title, int width, int height, bool fullscreen /*=
     m_fullscreen = fullscreen;
     m_maintainAspectRatio = maintainAspectRatio;
 
+    // Everything needs presenting in the first frame.
+    m_numDirtyRects = 0;
+    Invalidate(0, 0, width, height);
+
     if (!PlatformOpen(title, width, height))
     {
         delete[] m_pixels;
@@ -58,19 +84,206 @@ bool Window::Update()
 {
     UpdateMouse();
     UpdateKeyboard();
+
+    // The platform presents whatever is in the dirty list, so make that the whole buffer unless
+    // only changed regions were asked for.
+    if (!m_presentDirtyOnly)
+    {
+        m_numDirtyRects = 0;
+        Invalidate(0, 0, m_width, m_height);
+    }
+
+    if (m_targetFrameRate > 0.0f)
+        WaitForFrameDeadline();
+
+    // Present before pumping events, so that in wait mode the frame is on screen while we sleep.
+    // Events such as exposure may add dirty rects for the next frame.
+    PlatformPresent();
+    m_numDirtyRects = 0;
+
+    if (m_recorder)
+        m_recorder->AddFrame(m_pixels);
+
     bool result = PlatformUpdate();
+    if (m_fixedDelta > 0.0f)
+        m_delta = m_fixedDelta;
     m_time += m_delta;
     return result;
 }
 
+void Window::SetTargetFrameRate(float hz)
+{
+    m_targetFrameRate = hz;
+    m_frameDeadline = 0;
+    m_missedFrameCount = 0;
+    m_frameJitterCount = 0;
+}
+
+void Window::WaitForFrameDeadline()
+{
+    int64_t period = (int64_t)(m_freq / m_targetFrameRate);
+    int64_t now = PlatformGetTime();
+
+    if (m_frameDeadline == 0)
+    {
+        // First paced frame, start the clock from here.
+        m_frameDeadline = now;
+        return;
+    }
+
+    int64_t deadline = m_frameDeadline + period;
+    if (now > deadline)
+    {
+        // The frame took too long. Present straight away and pace from now on, rather than
+        // presenting a burst of frames to catch up. Sleeping for input doesn't count as a miss.
+        if (m_updateMode == UpdateMode_Poll)
+            m_missedFrameCount++;
+        deadline = now;
+    }
+    else
+    {
+        // Sleep for most of the remaining time, leaving a margin for however much sleeps have been
+        // overshooting by, then spin for the rest.
+        int64_t spinTime = m_sleepOvershoot + m_freq / 2000;
+        while (deadline - now > spinTime)
+        {
+            int64_t sleepTime = deadline - now - spinTime;
+            PlatformSleep(sleepTime);
+            int64_t after = PlatformGetTime();
+
+            // Track the overshoot with a moving average that reacts quickly to sleeps getting worse.
+            int64_t overshoot = std::max<int64_t>((after - now) - sleepTime, 0);
+            m_sleepOvershoot = overshoot > m_sleepOvershoot ? overshoot : (m_sleepOvershoot * 7 + overshoot) / 8;
+            spinTime = m_sleepOvershoot + m_freq / 2000;
+            now = after;
+        }
+
+        while (now < deadline)
+            now = PlatformGetTime();
+    }
+
+    // Jitter is how far this frame time was from the target. The next deadline is relative to the
+    // deadline we aimed for rather than when the spin ended, so the rate doesn't drift.
+    float frameTime = (now - m_frameDeadline) / (float)m_freq;
+    m_frameJitter[m_frameJitterCount % FrameHistorySize] = fabsf(frameTime - 1.0f / m_targetFrameRate);
+    m_frameJitterCount++;
+    m_frameDeadline = deadline;
+}
+
+float Window::GetFrameJitter(float percentile) const
+{
+    int count = (int)std::min(m_frameJitterCount, (uint32_t)FrameHistorySize);
+    if (count == 0)
+        return 0.0f;
+
+    float sorted[FrameHistorySize];
+    memcpy(sorted, m_frameJitter, count * sizeof(float));
+    std::sort(sorted, sorted + count);
+
+    int index = (int)((percentile / 100.0f) * (count - 1) + 0.5f);
+    return sorted[std::min(std::max(index, 0), count - 1)];
+}
+
 void Window::Close()
 {
+    StopRecording();
     PlatformClose();
 }
 
+bool Window::StartRecording(const char* path, RecordingFormat format, RecordingPolicy policy /*= RecordingPolicy_Drop*/)
+{
+    StopRecording();
+
+    int frameRate = m_targetFrameRate > 0.0f ? (int)(m_targetFrameRate + 0.5f) : 60;
+    Recorder* recorder = new Recorder();
+    if (!recorder->Start(path, format, policy, m_width, m_height, frameRate))
+    {
+        delete recorder;
+        return false;
+    }
+
+    m_recorder = recorder;
+    return true;
+}
+
+void Window::StopRecording()
+{
+    delete m_recorder;
+    m_recorder = 0;
+}
+
+uint32_t Window::GetDroppedRecordingFrameCount() const
+{
+    return m_recorder ? m_recorder->GetDroppedFrameCount() : 0;
+}
+
+void Window::Clear(uint32_t colour /*= 0*/)
+{
+    FillSpan(m_pixels, m_width * m_height, colour);
+    Invalidate(0, 0, m_width, m_height);
+}
+
+void Window::Invalidate(int x, int y, int width, int height)
+{
+    // Clip to the backing buffer.
+    int x0 = std::max(x, 0);
+    int y0 = std::max(y, 0);
+    int x1 = std::min(x + width, (int)m_width);
+    int y1 = std::min(y + height, (int)m_height);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    // Grow an existing rect if this one overlaps or touches it. Consecutive draws (e.g. the glyphs
+    // of a string or the rows of a widget) usually end up in the same rect this way.
+    for (int i = 0; i < m_numDirtyRects; i++)
+    {
+        DirtyRect& rect = m_dirtyRects[i];
+        if (x0 <= rect.x1 && x1 >= rect.x0 && y0 <= rect.y1 && y1 >= rect.y0)
+        {
+            rect.x0 = std::min(rect.x0, x0);
+            rect.y0 = std::min(rect.y0, y0);
+            rect.x1 = std::max(rect.x1, x1);
+            rect.y1 = std::max(rect.y1, y1);
+            return;
+        }
+    }
+
+    if (m_numDirtyRects < MaxDirtyRects)
+    {
+        DirtyRect& rect = m_dirtyRects[m_numDirtyRects++];
+        rect.x0 = x0;
+        rect.y0 = y0;
+        rect.x1 = x1;
+        rect.y1 = y1;
+        return;
+    }
+
+    // Out of rects, so merge into whichever one grows the least.
+    int best = 0;
+    int64_t bestGrowth = INT64_MAX;
+    for (int i = 0; i < m_numDirtyRects; i++)
+    {
+        const DirtyRect& rect = m_dirtyRects[i];
+        int64_t area = (int64_t)(rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+        int64_t mergedArea = (int64_t)(std::max(rect.x1, x1) - std::min(rect.x0, x0)) * (std::max(rect.y1, y1) - std::min(rect.y0, y0));
+        if (mergedArea - area < bestGrowth)
+        {
+            bestGrowth = mergedArea - area;
+            best = i;
+        }
+    }
+
+    DirtyRect& rect = m_dirtyRects[best];
+    rect.x0 = std::min(rect.x0, x0);
+    rect.y0 = std::min(rect.y0, y0);
+    rect.x1 = std::max(rect.x1, x1);
+    rect.y1 = std::max(rect.y1, y1);
+}
+
 void Window::UpdateMouse()
 {
     memcpy(m_lastMouseButtonDown, m_mouseButtonDown, sizeof(m_mouseButtonDown));
+    m_mouseWheel = 0.0f;
 }
 
 void Window::UpdateKeyboard()
@@ -64,11 +64,48 @@ namespace Pixie
         Key_Num
     };
 
+    enum UpdateMode
+    {
+        UpdateMode_Poll = 0,
+        UpdateMode_WaitForEvents
+    };
+
+    enum RecordingFormat
+    {
+        // Raw RGBA bytes, frame after frame with no header.
+        RecordingFormat_RawRGBA = 0,
+        // YUV4MPEG2 (4:2:0), which most video tools and encoders read directly.
+        RecordingFormat_Y4M,
+        // Y4M written to the standard input of a command, e.g. "ffmpeg -i - capture.mp4".
+        RecordingFormat_Pipe,
+        // Pixie capture file, keyframes plus the tiles that changed each frame. See CapturePlayer.
+        RecordingFormat_Capture
+    };
+
+    enum RecordingPolicy
+    {
+        // Frames are dropped while the writer is behind, so recording never slows the frame down.
+        RecordingPolicy_Drop = 0,
+        // Update waits for the writer, so every frame is recorded.
+        RecordingPolicy_Block
+    };
+
     enum
     {
-        MaxPlatformKeys = 256
+        MaxPlatformKeys = 256,
+        MaxDirtyRects = 16,
+        FrameHistorySize = 128
     };
 
+    // A region of the backing buffer, from (x0, y0) inclusive to (x1, y1) exclusive.
+    struct DirtyRect
+    {
+        int x0, y0;
+        int x1, y1;
+    };
+
+    class Recorder;
+
     class Window
     {
         public:
@@ -86,6 +123,48 @@ namespace Pixie
             // Update the Pixie window. This will copy the backing buffer to the actual window.
             bool Update();
 
+            // Fills the whole backing buffer with colour.
+            void Clear(uint32_t colour = 0);
+
+            // Marks a region of the backing buffer as changed. ImGui and Font do this automatically,
+            // code that writes to GetPixels() directly should invalidate the pixels it touches.
+            void Invalidate(int x, int y, int width, int height);
+
+            // Sets how Update waits for input. With UpdateMode_Poll (the default) Update returns straight
+            // away. With UpdateMode_WaitForEvents Update presents the frame and then sleeps until input
+            // or a window event arrives, or timeoutMs milliseconds pass. A negative timeout waits forever.
+            void SetUpdateMode(UpdateMode mode, int timeoutMs = -1);
+
+            // Caps the frame rate. Update sleeps (then spins for the last moment, as OS sleeps overshoot)
+            // until 1/hz seconds have passed since the previous frame before presenting. 0 disables the cap.
+            void SetTargetFrameRate(float hz);
+
+            // Returns the number of frames that were already past their deadline when Update was called,
+            // since the target frame rate was set.
+            uint32_t GetMissedFrameCount() const;
+
+            // Returns the given percentile (0 to 100) of frame pacing jitter, in seconds, over the last
+            // FrameHistorySize frames. Jitter is how far each frame time was from the target frame time.
+            float GetFrameJitter(float percentile) const;
+
+            // When enabled, Update only copies the regions invalidated since the last Update to the
+            // window instead of the whole backing buffer. Disabled by default.
+            void SetPresentDirtyOnly(bool enabled);
+
+            // Records every frame Update presents to path (a command line for RecordingFormat_Pipe). Frames
+            // are copied to a queue and converted and written on a background thread. The frame rate in
+            // the Y4M header is the target frame rate if one is set, otherwise 60.
+            bool StartRecording(const char* path, RecordingFormat format, RecordingPolicy policy = RecordingPolicy_Drop);
+
+            // Writes out any frames still queued and closes the recording.
+            void StopRecording();
+
+            // Returns true while recording.
+            bool IsRecording() const;
+
+            // Returns the number of frames dropped from the current recording.
+            uint32_t GetDroppedRecordingFrameCount() const;
+
             // Returns true in the frame the mouse button went down.
             bool HasMouseGoneDown(MouseButton button) const;
 
@@ -122,12 +201,19 @@ namespace Pixie
             // Returns the current mouse Y position.
             int GetMouseY() const;
 
+            // Returns how far the mouse wheel turned this frame, in notches. Positive is away from the user.
+            float GetMouseWheel() const;
+
             // Returns the time delta in seconds since the last time the window was updated.
             float GetDelta() const;
 
             // Returns the time in seconds since the window was opened.
             float GetTime() const;
 
+            // If delta is greater than zero, Update advances time by exactly this many seconds
+            // each frame instead of measuring the real clock. Useful for deterministic runs.
+            void SetFixedDelta(float delta);
+
             // Returns the backing buffer for the window.
             uint32_t* GetPixels() const;
 
@@ -146,20 +232,29 @@ namespace Pixie
 
             // Used by the window procedure to update key and mouse state.
             void SetMouseButtonDown(MouseButton button, bool down);
+            void AddMouseWheel(float notches);
             void SetKeyDown(int key, bool down);
             void AddInputCharacter(char c);
 
         private:
             void PlatformInit();
             bool PlatformOpen(const TCHAR* title, int width, int height);
+            void PlatformPresent();
             bool PlatformUpdate();
             void PlatformClose();
 
+            // Returns the current time in m_freq ticks per second, and sleeps for roughly that many ticks.
+            int64_t PlatformGetTime() const;
+            void PlatformSleep(int64_t ticks);
+
+            void WaitForFrameDeadline();
+
             void UpdateMouse();
             void UpdateKeyboard();
 
             int m_mouseX;
             int m_mouseY;
+            float m_mouseWheel;
             bool m_lastMouseButtonDown[MouseButton_Num];
             bool m_mouseButtonDown[MouseButton_Num];
 
@@ -170,8 +265,26 @@ namespace Pixie
             char m_inputCharacters[16+1];
 
             float m_delta;
+            float m_fixedDelta;
 
             uint32_t* m_pixels;
+            bool m_ownsPixels;
+            DirtyRect m_dirtyRects[MaxDirtyRects];
+            int m_numDirtyRects;
+            bool m_presentDirtyOnly;
+
+            UpdateMode m_updateMode;
+            int m_updateTimeoutMs;
+
+            float m_targetFrameRate;
+            int64_t m_frameDeadline;
+            int64_t m_sleepOvershoot;
+            uint32_t m_missedFrameCount;
+            float m_frameJitter[FrameHistorySize];
+            uint32_t m_frameJitterCount;
+
+            Recorder* m_recorder;
+
             uint32_t m_width;
             uint32_t m_height;
             uint32_t m_windowWidth;
@@ -200,6 +313,11 @@ namespace Pixie
         return m_mouseY;
     }
 
+    inline float Window::GetMouseWheel() const
+    {
+        return m_mouseWheel;
+    }
+
     inline float Window::GetDelta() const
     {
         return m_delta;
@@ -210,6 +328,32 @@ namespace Pixie
         return m_time;
     }
 
+    inline void Window::SetUpdateMode(UpdateMode mode, int timeoutMs /*= -1*/)
+    {
+        m_updateMode = mode;
+        m_updateTimeoutMs = timeoutMs;
+    }
+
+    inline uint32_t Window::GetMissedFrameCount() const
+    {
+        return m_missedFrameCount;
+    }
+
+    inline bool Window::IsRecording() const
+    {
+        return m_recorder != 0;
+    }
+
+    inline void Window::SetPresentDirtyOnly(bool enabled)
+    {
+        m_presentDirtyOnly = enabled;
+    }
+
+    inline void Window::SetFixedDelta(float delta)
+    {
+        m_fixedDelta = delta;
+    }
+
     inline uint32_t* Window::GetPixels() const
     {
         return m_pixels;
@@ -309,6 +453,11 @@ namespace Pixie
         m_mouseButtonDown[button] = down;
     }
 
+    inline void Window::AddMouseWheel(float notches)
+    {
+        m_mouseWheel += notches;
+    }
+
     inline void Window::SetKeyDown(int platformKey, bool down)
     {
         assert(platformKey >= 0 && platformKey < MaxPlatformKeys);
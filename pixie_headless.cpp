@@ -0,0 +1,64 @@
+#include "pixie.h"
+#include <assert.h>
+#include <chrono>
+#include <thread>
+
+using namespace Pixie;
+
+// Offscreen backend. The backing buffer is allocated by Window::Open as usual, input only
+// arrives through SetKeyDown/SetMouseButtonDown, and Update never presents anything.
+
+void Window::PlatformInit()
+{
+    // There are no platform keycodes, so the ASCII keymap set up by the constructor is used as-is.
+}
+
+bool Window::PlatformOpen(const TCHAR*, int width, int height)
+{
+    m_scalex = (float)m_scale;
+    m_scaley = (float)m_scale;
+    m_windowWidth = width * m_scale;
+    m_windowHeight = height * m_scale;
+    m_mouseX = 0;
+    m_mouseY = 0;
+
+    // Initialise the timer.
+    m_freq = 1000000000;
+    m_lastTime = PlatformGetTime();
+
+    return true;
+}
+
+void Window::PlatformPresent()
+{
+}
+
+bool Window::PlatformUpdate()
+{
+    // No events can arrive, so waiting just sleeps for the timeout. Waiting forever would never return.
+    if (m_updateMode == UpdateMode_WaitForEvents && m_updateTimeoutMs > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_updateTimeoutMs));
+
+    // Update the delta time. Window::Update replaces this if a fixed delta has been set.
+    int64_t time = PlatformGetTime();
+    int64_t delta = time - m_lastTime;
+    m_delta = delta / (float)m_freq;
+    m_lastTime = time;
+
+    return true;
+}
+
+void Window::PlatformClose()
+{
+}
+
+int64_t Window::PlatformGetTime() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Window::PlatformSleep(int64_t ticks)
+{
+    // Ticks are nanoseconds on this platform.
+    std::this_thread::sleep_for(std::chrono::nanoseconds(ticks));
+}
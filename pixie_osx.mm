@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <Carbon/Carbon.h>
 #include <mach/mach_time.h>
+#include <time.h>
 
 #if __MAC_OS_X_VERSION_MAX_ALLOWED < 101200
 #define NSWindowStyleMaskTitled NSTitledWindowMask
@@ -117,6 +118,11 @@ static const int FrameBufferBitDepth = 8;
     _pixieWindow->SetMouseButtonDown(MouseButton_Middle, false);
 }
 
+- (void)scrollWheel:(NSEvent *) theEvent
+{
+    _pixieWindow->AddMouseWheel(theEvent.scrollingDeltaY * (theEvent.hasPreciseScrollingDeltas ? 0.1f : 1.0f));
+}
+
 - (BOOL)acceptsFirstResponder
 {
     return YES;
@@ -320,10 +326,35 @@ bool Window::PlatformOpen(const char* title, int width, int height)
     return true;
 }
 
+void Window::PlatformPresent()
+{
+    PixieNSWindow* window = (PixieNSWindow*)m_window;
+
+    // Mark the dirty regions for refresh. The view's origin is bottom left, so flip the rects.
+    NSView* view = [window contentView];
+    for (int i = 0; i < m_numDirtyRects; i++)
+    {
+        const DirtyRect& rect = m_dirtyRects[i];
+        [view setNeedsDisplayInRect:NSMakeRect(rect.x0 * m_scalex, (m_height - rect.y1) * m_scaley, (rect.x1 - rect.x0) * m_scalex, (rect.y1 - rect.y0) * m_scaley)];
+    }
+
+    // Draw now rather than on the next pass through the run loop, which may be a while in wait mode.
+    [window displayIfNeeded];
+}
+
 bool Window::PlatformUpdate()
 {
     PixieNSWindow* window = (PixieNSWindow*)m_window;
 
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+
+    if (m_updateMode == UpdateMode_WaitForEvents)
+    {
+        // Sleep until an event arrives or the timeout expires. The event is left in the queue for the pump below.
+        NSDate* until = m_updateTimeoutMs < 0 ? [NSDate distantFuture] : [NSDate dateWithTimeIntervalSinceNow:m_updateTimeoutMs / 1000.0];
+        [NSApp nextEventMatchingMask:NSEventMaskAny untilDate:until inMode:NSDefaultRunLoopMode dequeue:NO];
+    }
+
     // Update mouse cursor position.
     NSPoint mousePos;
     mousePos = [window mouseLocationOutsideOfEventStream];
@@ -339,8 +370,6 @@ bool Window::PlatformUpdate()
     m_delta = delta / (float)m_freq;
     m_lastTime = time;
 
-    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-
     // Pump messages.
     NSEvent* event;
     while (nil != (event = [NSApp nextEventMatchingMask:NSEventMaskAny untilDate:[NSDate distantPast] inMode:NSDefaultRunLoopMode dequeue:YES]))
@@ -348,9 +377,6 @@ bool Window::PlatformUpdate()
         [NSApp sendEvent:event];
     }
 
-    // Force the display to refresh.
-    [[window contentView] setNeedsDisplay:TRUE];
-
     // Steal focus the first chance we get.
     if (![window isActivated])
     {
@@ -363,6 +389,20 @@ bool Window::PlatformUpdate()
     return [window isRunning];
 }
 
+int64_t Window::PlatformGetTime() const
+{
+    return mach_absolute_time();
+}
+
+void Window::PlatformSleep(int64_t ticks)
+{
+    int64_t ns = (ticks * 1000000000) / m_freq;
+    timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
 void Window::PlatformClose()
 {
     PixieNSWindow* window = (PixieNSWindow*)m_window;
@@ -1,6 +1,7 @@
 #include "pixie.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <mmsystem.h>
 
 using namespace Pixie;
 
@@ -131,53 +132,14 @@ bool Window::PlatformOpen(const TCHAR* title, int width, int height)
     return true;
 }
 
-bool Window::PlatformUpdate()
+void Window::PlatformPresent()
 {
-    // Update mouse cursor location.
-    POINT p;
-    GetCursorPos(&p);
-    ScreenToClient((HWND)m_window, &p);
-
-    // Apply dpi scaling as context is set to dpi-unaware
-    UINT dpi = GetDpiForWindow((HWND)m_window);
-    float dpi_scale = dpi / 96.0f;
-    m_mouseX = static_cast<int>(p.x*dpi_scale);
-    m_mouseY = static_cast<int>(p.y*dpi_scale);
-
-    if (m_fullscreen)
-    {
-        m_mouseX = (int)(m_mouseX / m_scalex);
-        m_mouseY = (int)(m_mouseY / m_scaley);
-    }
-    else
-    {
-        m_mouseX /= m_scale;
-        m_mouseY /= m_scale;
-    }
-
-    __int64 time;
-    QueryPerformanceCounter((LARGE_INTEGER*)&time);
-    __int64 delta = time - m_lastTime;
-    m_delta = (delta / (float)m_freq);
-    m_lastTime = time;
-
-    MSG msg;
-    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
-    {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
-
-        if (msg.message == WM_QUIT)
-            return false;
-    }
-
-    // Copy buffer to the window.
+    // Copy the dirty regions of the buffer to the window.
     HDC hdc = GetDC((HWND)m_window);
     BITMAPINFO bitmapInfo;
     BITMAPINFOHEADER& bmiHeader = bitmapInfo.bmiHeader;
     bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
     bmiHeader.biWidth = m_width;
-    bmiHeader.biHeight = -(int32_t)m_height; // Negative indicates a top-down DIB. Otherwise DIB is bottom up.
     bmiHeader.biPlanes = 1;
     bmiHeader.biBitCount = 32;
     bmiHeader.biCompression = BI_RGB;
@@ -209,17 +171,98 @@ bool Window::PlatformUpdate()
             FillRect(hdc, &rect, blackBrush);
         }
 
-        StretchDIBits(hdc, 0, yofs, destWidth, destHeight, 0, 0, m_width, m_height, m_pixels, &bitmapInfo, DIB_RGB_COLORS, SRCCOPY);
+        for (int i = 0; i < m_numDirtyRects; i++)
+        {
+            // Each rect is passed as a top-down DIB of just its rows so the source y is always 0,
+            // which sidesteps StretchDIBits measuring ySrc from the bottom.
+            const DirtyRect& rect = m_dirtyRects[i];
+            int rows = rect.y1 - rect.y0;
+            bmiHeader.biHeight = -rows;
+            int destX0 = (rect.x0 * destWidth) / (int)m_width;
+            int destY0 = (rect.y0 * destHeight) / (int)m_height;
+            int destX1 = (rect.x1 * destWidth) / (int)m_width;
+            int destY1 = (rect.y1 * destHeight) / (int)m_height;
+            StretchDIBits(hdc, destX0, yofs + destY0, destX1 - destX0, destY1 - destY0, rect.x0, 0, rect.x1 - rect.x0, rows, m_pixels + (rect.y0 * m_width), &bitmapInfo, DIB_RGB_COLORS, SRCCOPY);
+        }
     }
     else
     {
-        SetDIBitsToDevice(hdc, 0, 0, m_width, m_height, 0, 0, 0, m_height, m_pixels, &bitmapInfo, DIB_RGB_COLORS);
+        for (int i = 0; i < m_numDirtyRects; i++)
+        {
+            const DirtyRect& rect = m_dirtyRects[i];
+            int rows = rect.y1 - rect.y0;
+            bmiHeader.biHeight = -rows; // Negative indicates a top-down DIB. Otherwise DIB is bottom up.
+            SetDIBitsToDevice(hdc, rect.x0, rect.y0, rect.x1 - rect.x0, rows, rect.x0, 0, 0, rows, m_pixels + (rect.y0 * m_width), &bitmapInfo, DIB_RGB_COLORS);
+        }
     }
     ReleaseDC((HWND)m_window, hdc);
+}
+
+bool Window::PlatformUpdate()
+{
+    if (m_updateMode == UpdateMode_WaitForEvents)
+    {
+        // Sleep until there is something in the message queue or the timeout expires.
+        DWORD timeout = m_updateTimeoutMs < 0 ? INFINITE : (DWORD)m_updateTimeoutMs;
+        MsgWaitForMultipleObjectsEx(0, NULL, timeout, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+    }
+
+    // Update mouse cursor location.
+    POINT p;
+    GetCursorPos(&p);
+    ScreenToClient((HWND)m_window, &p);
+
+    // Apply dpi scaling as context is set to dpi-unaware
+    UINT dpi = GetDpiForWindow((HWND)m_window);
+    float dpi_scale = dpi / 96.0f;
+    m_mouseX = static_cast<int>(p.x*dpi_scale);
+    m_mouseY = static_cast<int>(p.y*dpi_scale);
+
+    if (m_fullscreen)
+    {
+        m_mouseX = (int)(m_mouseX / m_scalex);
+        m_mouseY = (int)(m_mouseY / m_scaley);
+    }
+    else
+    {
+        m_mouseX /= m_scale;
+        m_mouseY /= m_scale;
+    }
+
+    __int64 time;
+    QueryPerformanceCounter((LARGE_INTEGER*)&time);
+    __int64 delta = time - m_lastTime;
+    m_delta = (delta / (float)m_freq);
+    m_lastTime = time;
+
+    MSG msg;
+    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+    {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+
+        if (msg.message == WM_QUIT)
+            return false;
+    }
 
     return true;
 }
 
+int64_t Window::PlatformGetTime() const
+{
+    __int64 time;
+    QueryPerformanceCounter((LARGE_INTEGER*)&time);
+    return time;
+}
+
+void Window::PlatformSleep(int64_t ticks)
+{
+    // Raise the scheduler resolution to 1ms while sleeping, the default is around 15.6ms.
+    timeBeginPeriod(1);
+    Sleep((DWORD)((ticks * 1000) / m_freq));
+    timeEndPeriod(1);
+}
+
 void Window::PlatformClose()
 {
     DestroyWindow((HWND)m_window);
@@ -291,6 +334,12 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
                 break;
             }
 
+            case WM_MOUSEWHEEL:
+            {
+                window->AddMouseWheel((float)GET_WHEEL_DELTA_WPARAM(wParam) / WHEEL_DELTA);
+                break;
+            }
+
             case WM_KEYDOWN:
             case WM_SYSKEYDOWN:
             {
@@ -320,6 +369,13 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
                 break;
             }
 
+            case WM_PAINT:
+            {
+                // Part of the window has been uncovered, so it all needs presenting again.
+                window->Invalidate(0, 0, window->GetWidth(), window->GetHeight());
+                break;
+            }
+
             case WM_DESTROY:
             {
                 PostQuitMessage(0);
@@ -0,0 +1,493 @@
+#include "pixie.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
+
+// Xlib declares its own global Window type, so the definitions below live inside the Pixie
+// namespace (where Window resolves to Pixie::Window) and X11 windows are spelt ::Window.
+namespace Pixie
+{
+
+struct X11State
+{
+    Display* display;
+    ::Window window;
+    GC gc;
+    Atom deleteWindowAtom;
+    bool running;
+
+    // The image that is presented. When the window is unscaled its data is the backing buffer
+    // itself, otherwise the backing buffer is stretched into it every frame.
+    XImage* image;
+    XShmSegmentInfo shmInfo;
+    bool useShm;
+    bool imageIsBackingBuffer;
+
+    // Where the image is placed within the window.
+    int destX, destY;
+    int destWidth, destHeight;
+
+    // Last known mouse position in window coordinates.
+    int mouseX, mouseY;
+};
+
+static bool s_shmAttachFailed = false;
+
+static int ShmErrorHandler(Display*, XErrorEvent*)
+{
+    s_shmAttachFailed = true;
+    return 0;
+}
+
+// Creates an image in a shared memory segment. Returns NULL if the server can't attach it
+// (for instance when the display is remote), in which case the caller falls back to XPutImage.
+static XImage* CreateShmImage(Display* display, Visual* visual, int depth, int width, int height, XShmSegmentInfo* shmInfo)
+{
+    XImage* image = XShmCreateImage(display, visual, depth, ZPixmap, NULL, shmInfo, width, height);
+    if (!image)
+        return NULL;
+
+    shmInfo->shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height, IPC_CREAT | 0600);
+    if (shmInfo->shmid < 0)
+    {
+        XDestroyImage(image);
+        return NULL;
+    }
+
+    shmInfo->shmaddr = image->data = (char*)shmat(shmInfo->shmid, NULL, 0);
+    shmInfo->readOnly = False;
+    if (shmInfo->shmaddr == (char*)-1)
+    {
+        shmctl(shmInfo->shmid, IPC_RMID, NULL);
+        image->data = NULL;
+        XDestroyImage(image);
+        return NULL;
+    }
+
+    // XShmAttach only reports failure asynchronously, so trap errors until the server has replied.
+    s_shmAttachFailed = false;
+    XErrorHandler previousHandler = XSetErrorHandler(ShmErrorHandler);
+    XShmAttach(display, shmInfo);
+    XSync(display, False);
+    XSetErrorHandler(previousHandler);
+
+    // Mark the segment for deletion now so it can't leak; it stays valid until detached.
+    shmctl(shmInfo->shmid, IPC_RMID, NULL);
+
+    if (s_shmAttachFailed)
+    {
+        shmdt(shmInfo->shmaddr);
+        image->data = NULL;
+        XDestroyImage(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+static void DestroyImage(X11State* state)
+{
+    if (!state->image)
+        return;
+
+    if (state->useShm)
+    {
+        XShmDetach(state->display, &state->shmInfo);
+        XSync(state->display, False);
+        shmdt(state->shmInfo.shmaddr);
+    }
+    else if (!state->imageIsBackingBuffer)
+    {
+        free(state->image->data);
+    }
+
+    // The pixel data has been released above, don't let Xlib free it as well.
+    state->image->data = NULL;
+    XDestroyImage(state->image);
+    state->image = NULL;
+}
+
+// Nearest neighbour stretch of the backing buffer into the region (x0, y0)-(x1, y1) of the presented image.
+static void StretchPixels(const uint32_t* src, int srcWidth, int srcHeight, XImage* image, int x0, int y0, int x1, int y1)
+{
+    int dstWidth = image->width;
+    int dstHeight = image->height;
+    int dstPitch = image->bytes_per_line / sizeof(uint32_t);
+    uint32_t* dst = (uint32_t*)image->data;
+
+    int lastSrcY = -1;
+    for (int y = y0; y < y1; y++)
+    {
+        uint32_t* dstRow = dst + (y * dstPitch);
+        int srcY = (y * srcHeight) / dstHeight;
+        if (srcY == lastSrcY)
+        {
+            // Same source row as the previous line, so just duplicate it.
+            memcpy(dstRow + x0, dstRow + x0 - dstPitch, (x1 - x0) * sizeof(uint32_t));
+            continue;
+        }
+
+        const uint32_t* srcRow = src + (srcY * srcWidth);
+        for (int x = x0; x < x1; x++)
+            dstRow[x] = srcRow[(x * srcWidth) / dstWidth];
+
+        lastSrcY = srcY;
+    }
+}
+
+void Window::PlatformInit()
+{
+    // Reset all keymap entries to invalid, keycodes are looked up once the display is open.
+    for (int i = 0; i < Key_Num; i++)
+        m_keyMap[i] = Key_Num;
+}
+
+bool Window::PlatformOpen(const TCHAR* title, int width, int height)
+{
+    Display* display = XOpenDisplay(NULL);
+    if (!display)
+        return false;
+
+    int screen = DefaultScreen(display);
+    Visual* visual = DefaultVisual(display, screen);
+    int depth = DefaultDepth(display, screen);
+
+    // The backing buffer is BGRx, which only matches a 24/32-bit TrueColor visual.
+    if (depth < 24 || visual->c_class != TrueColor || visual->red_mask != 0xff0000 || visual->green_mask != 0xff00 || visual->blue_mask != 0xff)
+    {
+        XCloseDisplay(display);
+        return false;
+    }
+
+    const KeySym keySyms[] =
+    {
+        XK_BackSpace, XK_Tab, XK_Return, XK_Escape,
+        XK_Up, XK_Down, XK_Left, XK_Right,
+        XK_Home, XK_End, XK_Prior, XK_Next,
+        XK_Delete, XK_Insert,
+        XK_Shift_L, XK_Shift_R, XK_Control_L, XK_Control_R, XK_Alt_L, XK_Alt_R,
+        XK_F1, XK_F2, XK_F3, XK_F4, XK_F5, XK_F6, XK_F7, XK_F8, XK_F9, XK_F10, XK_F11, XK_F12,
+    };
+
+    for (int i = 0; i < (int)(sizeof(keySyms) / sizeof(keySyms[0])); i++)
+    {
+        KeyCode keyCode = XKeysymToKeycode(display, keySyms[i]);
+        if (keyCode != 0)
+            m_keyMap[i] = keyCode;
+    }
+
+    // Latin-1 keysyms are the same as their ASCII values.
+    for (int i = Key_ASCII_Start; i < Key_ASCII_End; i++)
+    {
+        KeyCode keyCode = XKeysymToKeycode(display, (KeySym)i);
+        if (keyCode != 0)
+            m_keyMap[i] = keyCode;
+    }
+
+    m_scalex = (float)m_scale;
+    m_scaley = (float)m_scale;
+
+    int destX = 0, destY = 0;
+    int destWidth = width * m_scale;
+    int destHeight = height * m_scale;
+
+    if (m_fullscreen)
+    {
+        width = DisplayWidth(display, screen);
+        height = DisplayHeight(display, screen);
+        m_scalex = width / (float)m_width;
+        m_scaley = m_maintainAspectRatio ? m_scalex : (height / (float)m_height);
+        destWidth = (int)(m_width * m_scalex);
+        destHeight = (int)(m_height * m_scaley);
+        if (m_maintainAspectRatio)
+            destY = (height - destHeight) >> 1;
+    }
+    else
+    {
+        width = destWidth;
+        height = destHeight;
+    }
+
+    m_windowWidth = width;
+    m_windowHeight = height;
+
+    XSetWindowAttributes attributes;
+    attributes.background_pixel = BlackPixel(display, screen);
+    attributes.event_mask = KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ExposureMask | StructureNotifyMask;
+
+    ::Window window = XCreateWindow(display, RootWindow(display, screen), 0, 0, width, height, 0, depth, InputOutput, visual, CWBackPixel | CWEventMask, &attributes);
+    if (!window)
+    {
+        XCloseDisplay(display);
+        return false;
+    }
+
+    XStoreName(display, window, title);
+
+    // Pixie windows are a fixed size.
+    XSizeHints* sizeHints = XAllocSizeHints();
+    sizeHints->flags = PMinSize | PMaxSize;
+    sizeHints->min_width = sizeHints->max_width = width;
+    sizeHints->min_height = sizeHints->max_height = height;
+    XSetWMNormalHints(display, window, sizeHints);
+    XFree(sizeHints);
+
+    if (m_fullscreen)
+    {
+        Atom wmState = XInternAtom(display, "_NET_WM_STATE", False);
+        Atom wmFullscreen = XInternAtom(display, "_NET_WM_STATE_FULLSCREEN", False);
+        XChangeProperty(display, window, wmState, XA_ATOM, 32, PropModeReplace, (unsigned char*)&wmFullscreen, 1);
+    }
+
+    X11State* state = new X11State;
+    memset(state, 0, sizeof(*state));
+    state->display = display;
+    state->window = window;
+    state->gc = XCreateGC(display, window, 0, NULL);
+    state->running = true;
+    state->destX = destX;
+    state->destY = destY;
+    state->destWidth = destWidth;
+    state->destHeight = destHeight;
+
+    // Ask the window manager to tell us about the close button rather than killing the connection.
+    state->deleteWindowAtom = XInternAtom(display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(display, window, &state->deleteWindowAtom, 1);
+
+    // Don't report auto-repeat as a stream of key up/down pairs.
+    XkbSetDetectableAutoRepeat(display, True, NULL);
+
+    // Create the image to present, in shared memory when the server supports it.
+    state->imageIsBackingBuffer = destWidth == (int)m_width && destHeight == (int)m_height;
+    if (XShmQueryExtension(display))
+        state->image = CreateShmImage(display, visual, depth, destWidth, destHeight, &state->shmInfo);
+    state->useShm = state->image != NULL;
+
+    if (state->useShm)
+    {
+        if (state->imageIsBackingBuffer)
+        {
+            // Draw straight into the shared segment so presenting needs no copy at all.
+            delete[] m_pixels;
+            m_pixels = (uint32_t*)state->image->data;
+            m_ownsPixels = false;
+        }
+    }
+    else
+    {
+        char* data = state->imageIsBackingBuffer ? (char*)m_pixels : (char*)malloc(destWidth * destHeight * sizeof(uint32_t));
+        state->image = XCreateImage(display, visual, depth, ZPixmap, 0, data, destWidth, destHeight, 32, 0);
+        if (!state->image)
+        {
+            if (!state->imageIsBackingBuffer)
+                free(data);
+            XFreeGC(display, state->gc);
+            XDestroyWindow(display, window);
+            XCloseDisplay(display);
+            delete state;
+            return false;
+        }
+    }
+
+    m_window = state;
+
+    XMapWindow(display, window);
+    XFlush(display);
+
+    m_mouseX = m_mouseY = 0;
+
+    // Initialise the timer.
+    m_freq = 1000000000;
+    m_lastTime = PlatformGetTime();
+
+    return true;
+}
+
+void Window::PlatformPresent()
+{
+    X11State* state = (X11State*)m_window;
+    Display* display = state->display;
+
+    if (state->destY > 0)
+    {
+        // Fill top/bottom with black for letterboxing.
+        XSetForeground(display, state->gc, BlackPixel(display, DefaultScreen(display)));
+        XFillRectangle(display, state->window, state->gc, 0, 0, m_windowWidth, state->destY);
+        XFillRectangle(display, state->window, state->gc, 0, m_windowHeight - state->destY, m_windowWidth, state->destY);
+    }
+
+    // Copy the dirty regions of the buffer to the window.
+    for (int i = 0; i < m_numDirtyRects; i++)
+    {
+        const DirtyRect& rect = m_dirtyRects[i];
+        int x0 = rect.x0, y0 = rect.y0, x1 = rect.x1, y1 = rect.y1;
+
+        if (!state->imageIsBackingBuffer)
+        {
+            // Find the image pixels whose nearest source pixel lies inside the rect.
+            x0 = (x0 * state->destWidth + m_width - 1) / m_width;
+            y0 = (y0 * state->destHeight + m_height - 1) / m_height;
+            x1 = (x1 * state->destWidth + m_width - 1) / m_width;
+            y1 = (y1 * state->destHeight + m_height - 1) / m_height;
+            StretchPixels(m_pixels, m_width, m_height, state->image, x0, y0, x1, y1);
+        }
+
+        if (state->useShm)
+            XShmPutImage(display, state->window, state->gc, state->image, x0, y0, state->destX + x0, state->destY + y0, x1 - x0, y1 - y0, False);
+        else
+            XPutImage(display, state->window, state->gc, state->image, x0, y0, state->destX + x0, state->destY + y0, x1 - x0, y1 - y0);
+    }
+
+    // Wait for the server to finish reading the image before the caller starts drawing the next frame.
+    XSync(display, False);
+}
+
+bool Window::PlatformUpdate()
+{
+    X11State* state = (X11State*)m_window;
+    Display* display = state->display;
+
+    if (m_updateMode == UpdateMode_WaitForEvents && !XPending(display))
+    {
+        // Sleep until the server sends something or the timeout expires.
+        pollfd fd;
+        fd.fd = ConnectionNumber(display);
+        fd.events = POLLIN;
+        fd.revents = 0;
+        poll(&fd, 1, m_updateTimeoutMs);
+    }
+
+    // Update the delta time.
+    int64_t time = PlatformGetTime();
+    int64_t delta = time - m_lastTime;
+    m_delta = delta / (float)m_freq;
+    m_lastTime = time;
+
+    // Pump events.
+    while (XPending(display))
+    {
+        XEvent event;
+        XNextEvent(display, &event);
+
+        switch (event.type)
+        {
+            case KeyPress:
+            case KeyRelease:
+            {
+                bool down = event.type == KeyPress;
+                if (event.xkey.keycode < MaxPlatformKeys)
+                    SetKeyDown(event.xkey.keycode, down);
+
+                if (down)
+                {
+                    char characters[8];
+                    int count = XLookupString(&event.xkey, characters, sizeof(characters), NULL, NULL);
+                    for (int i = 0; i < count; i++)
+                        AddInputCharacter(characters[i]);
+                }
+                break;
+            }
+
+            case ButtonPress:
+            case ButtonRelease:
+            {
+                bool down = event.type == ButtonPress;
+                if (event.xbutton.button == Button1) SetMouseButtonDown(MouseButton_Left, down);
+                if (event.xbutton.button == Button2) SetMouseButtonDown(MouseButton_Middle, down);
+                if (event.xbutton.button == Button3) SetMouseButtonDown(MouseButton_Right, down);
+                // The wheel arrives as presses of buttons 4 (up) and 5 (down).
+                if (down && event.xbutton.button == Button4) AddMouseWheel(1.0f);
+                if (down && event.xbutton.button == Button5) AddMouseWheel(-1.0f);
+                state->mouseX = event.xbutton.x;
+                state->mouseY = event.xbutton.y;
+                break;
+            }
+
+            case Expose:
+            {
+                // Part of the window has been uncovered, so it all needs presenting again.
+                if (event.xexpose.count == 0)
+                    Invalidate(0, 0, m_width, m_height);
+                break;
+            }
+
+            case MotionNotify:
+            {
+                state->mouseX = event.xmotion.x;
+                state->mouseY = event.xmotion.y;
+                break;
+            }
+
+            case ClientMessage:
+            {
+                if ((Atom)event.xclient.data.l[0] == state->deleteWindowAtom)
+                    state->running = false;
+                break;
+            }
+
+            case DestroyNotify:
+            {
+                state->running = false;
+                break;
+            }
+        }
+    }
+
+    if (!state->running)
+        return false;
+
+    // Update mouse cursor location.
+    m_mouseX = (int)((state->mouseX - state->destX) / m_scalex);
+    m_mouseY = (int)((state->mouseY - state->destY) / m_scaley);
+
+    return true;
+}
+
+int64_t Window::PlatformGetTime() const
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Window::PlatformSleep(int64_t ticks)
+{
+    // Ticks are nanoseconds on this platform.
+    timespec ts;
+    ts.tv_sec = ticks / 1000000000;
+    ts.tv_nsec = ticks % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
+void Window::PlatformClose()
+{
+    X11State* state = (X11State*)m_window;
+    if (!state)
+        return;
+
+    if (!m_ownsPixels)
+    {
+        // The backing buffer is the shared segment, which is about to go away.
+        m_pixels = 0;
+        m_ownsPixels = true;
+    }
+
+    DestroyImage(state);
+    XFreeGC(state->display, state->gc);
+    XDestroyWindow(state->display, state->window);
+    XCloseDisplay(state->display);
+    delete state;
+    m_window = 0;
+}
+
+}
@@ -0,0 +1,151 @@
+#include "plot.h"
+#include "simd.h"
+#include <assert.h>
+#include <algorithm>
+
+using namespace Pixie;
+
+// Folds count floats into min and max.
+static void MinMaxSpan(const float* data, int count, float& min, float& max)
+{
+    int i = 0;
+#if PIXIE_SSE2
+    if (count >= 8)
+    {
+        __m128 vmin = _mm_set1_ps(min);
+        __m128 vmax = _mm_set1_ps(max);
+        for ( ; i + 8 <= count; i += 8)
+        {
+            __m128 a = _mm_loadu_ps(data + i);
+            __m128 b = _mm_loadu_ps(data + i + 4);
+            vmin = _mm_min_ps(vmin, _mm_min_ps(a, b));
+            vmax = _mm_max_ps(vmax, _mm_max_ps(a, b));
+        }
+
+        // Reduce the four lanes.
+        vmin = _mm_min_ps(vmin, _mm_shuffle_ps(vmin, vmin, _MM_SHUFFLE(1, 0, 3, 2)));
+        vmin = _mm_min_ps(vmin, _mm_shuffle_ps(vmin, vmin, _MM_SHUFFLE(2, 3, 0, 1)));
+        vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+        vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+        min = _mm_cvtss_f32(vmin);
+        max = _mm_cvtss_f32(vmax);
+    }
+#endif
+    for ( ; i < count; i++)
+    {
+        min = std::min(min, data[i]);
+        max = std::max(max, data[i]);
+    }
+}
+
+PlotBuffer::PlotBuffer(int capacity)
+{
+    assert(capacity > 0);
+    uint32_t size = 1;
+    while (size < (uint32_t)capacity)
+        size <<= 1;
+
+    m_samples.resize(size);
+    m_mask = size - 1;
+    m_total = 0;
+
+    // A level per 16x block size, while the blocks still fit.
+    for (int shift = LevelShift; (1u << shift) <= size; shift += LevelShift)
+    {
+        Level level;
+        level.shift = shift;
+        level.min.resize(size >> shift);
+        level.max.resize(size >> shift);
+        m_levels.push_back(level);
+    }
+}
+
+void PlotBuffer::Add(float value)
+{
+    m_samples[(uint32_t)m_total & m_mask] = value;
+
+    // The first sample of a block starts it afresh, which also drops the samples it replaces.
+    for (size_t i = 0; i < m_levels.size(); i++)
+    {
+        Level& level = m_levels[i];
+        uint32_t block = (uint32_t)(m_total >> level.shift) & (m_mask >> level.shift);
+        if ((m_total & ((1u << level.shift) - 1)) == 0)
+        {
+            level.min[block] = value;
+            level.max[block] = value;
+        }
+        else
+        {
+            level.min[block] = std::min(level.min[block], value);
+            level.max[block] = std::max(level.max[block], value);
+        }
+    }
+
+    m_total++;
+}
+
+void PlotBuffer::Add(const float* values, int count)
+{
+    for (int i = 0; i < count; i++)
+        Add(values[i]);
+}
+
+void PlotBuffer::Clear()
+{
+    m_total = 0;
+}
+
+bool PlotBuffer::GetRange(int first, int count, float& min, float& max) const
+{
+    assert(first >= 0 && count >= 0 && first + count <= GetCount());
+    if (count == 0)
+        return false;
+
+    uint64_t start = m_total - GetCount() + first;
+    min = GetSample(first);
+    max = min;
+    GetRange((int)m_levels.size() - 1, start, start + count, min, max);
+    return true;
+}
+
+void PlotBuffer::GetRange(int level, uint64_t first, uint64_t end, float& min, float& max) const
+{
+    // Below the first level, read the samples, in up to two pieces where they wrap.
+    if (level < 0)
+    {
+        while (first < end)
+        {
+            uint32_t index = (uint32_t)first & m_mask;
+            int count = (int)std::min<uint64_t>(end - first, m_samples.size() - index);
+            MinMaxSpan(&m_samples[index], count, min, max);
+            first += count;
+        }
+        return;
+    }
+
+    // Use this level's blocks that lie wholly inside the range, and finer levels for the ends.
+    // Blocks inside the range are all held, so their slots haven't been reused.
+    const Level& blocks = m_levels[level];
+    uint64_t firstBlock = (first + (1u << blocks.shift) - 1) >> blocks.shift;
+    uint64_t endBlock = end >> blocks.shift;
+    if (firstBlock >= endBlock)
+    {
+        GetRange(level - 1, first, end, min, max);
+        return;
+    }
+
+    GetRange(level - 1, first, firstBlock << blocks.shift, min, max);
+    uint32_t blockMask = m_mask >> blocks.shift;
+    while (firstBlock < endBlock)
+    {
+        uint32_t index = (uint32_t)firstBlock & blockMask;
+        int count = (int)std::min<uint64_t>(endBlock - firstBlock, (uint64_t)blockMask + 1 - index);
+        // Only the minimums matter from the min blocks and the maximums from the max blocks.
+        float blockMin = min;
+        float blockMax = max;
+        MinMaxSpan(&blocks.min[index], count, min, blockMax);
+        MinMaxSpan(&blocks.max[index], count, blockMin, max);
+        firstBlock += count;
+    }
+    GetRange(level - 1, endBlock << blocks.shift, end, min, max);
+}
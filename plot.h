@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace Pixie
+{
+    // Holds the most recent samples of a signal for plotting. Alongside the samples it keeps the
+    // minimum and maximum of every aligned block of 16, 256, 4096... samples, updated as samples
+    // are added, so the range of any run of samples is found in time that grows with the log of
+    // its length rather than the length. Not thread safe.
+    class PlotBuffer
+    {
+        public:
+            // Keeps the last capacity samples. The capacity is rounded up to a power of two.
+            PlotBuffer(int capacity);
+
+            void Add(float value);
+            void Add(const float* values, int count);
+            void Clear();
+
+            // Returns the number of samples held, at most the capacity.
+            int GetCount() const;
+            int GetCapacity() const;
+
+            // Returns the sample the given number of samples after the oldest one held.
+            float GetSample(int index) const;
+
+            // Finds the smallest and largest of count samples, starting first samples after the
+            // oldest one held. Returns false if count is 0.
+            bool GetRange(int first, int count, float& min, float& max) const;
+
+        private:
+            enum
+            {
+                LevelShift = 4
+            };
+
+            struct Level
+            {
+                int shift;
+                std::vector<float> min;
+                std::vector<float> max;
+            };
+
+            void GetRange(int level, uint64_t first, uint64_t end, float& min, float& max) const;
+
+            std::vector<float> m_samples;
+            uint32_t m_mask;
+            // Samples ever added. The ones held are m_total - GetCount() up to m_total.
+            uint64_t m_total;
+            std::vector<Level> m_levels;
+    };
+
+    inline int PlotBuffer::GetCount() const
+    {
+        return m_total < m_samples.size() ? (int)m_total : (int)m_samples.size();
+    }
+
+    inline int PlotBuffer::GetCapacity() const
+    {
+        return (int)m_samples.size();
+    }
+
+    inline float PlotBuffer::GetSample(int index) const
+    {
+        return m_samples[(uint32_t)(m_total - GetCount() + index) & m_mask];
+    }
+}
@@ -0,0 +1,378 @@
+#include "recorder.h"
+#include "simd.h"
+#include <string.h>
+#include <algorithm>
+
+#if PIXIE_PLATFORM_WIN
+#define popen _popen
+#define pclose _pclose
+#else
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+using namespace Pixie;
+
+#if !PIXIE_PLATFORM_WIN
+// Writing to a pipe whose encoder has exited raises SIGPIPE, which kills the process by default.
+// With it blocked on the writing thread the write fails with EPIPE instead.
+static void BlockSigPipe(sigset_t& previous)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, &previous);
+}
+
+static void RestoreSigPipe(const sigset_t& previous)
+{
+    // Take any SIGPIPE raised while blocked, so it isn't delivered once unblocked. sigpending and
+    // sigwait rather than sigtimedwait, which macOS doesn't have.
+    if (!sigismember(&previous, SIGPIPE))
+    {
+        sigset_t pending;
+        sigpending(&pending);
+        if (sigismember(&pending, SIGPIPE))
+        {
+            sigset_t set;
+            sigemptyset(&set);
+            sigaddset(&set, SIGPIPE);
+            int signal;
+            sigwait(&set, &signal);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, 0);
+}
+#endif
+
+// Full range BT.601 with 8 bit coefficients. Chroma is computed from the sum of a 2x2 block, so the
+// SSE2 and scalar paths give identical results.
+static inline uint8_t Luma(int r, int g, int b)
+{
+    return (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+}
+
+static inline uint8_t ChromaBlue(int sumR, int sumG, int sumB)
+{
+    return (uint8_t)std::min(((-43 * sumR - 85 * sumG + 128 * sumB + 512) >> 10) + 128, 255);
+}
+
+static inline uint8_t ChromaRed(int sumR, int sumG, int sumB)
+{
+    return (uint8_t)std::min(((128 * sumR - 107 * sumG - 21 * sumB + 512) >> 10) + 128, 255);
+}
+
+#if PIXIE_SSE2
+// Splits 8 BGRx pixels into 16 bit channels.
+static inline void SplitChannels(const uint32_t* src, __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i lo = _mm_loadu_si128((const __m128i*)src);
+    __m128i hi = _mm_loadu_si128((const __m128i*)(src + 4));
+    b = _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask), _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+    r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask), _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+}
+
+// 8 luma values. The sum never goes over 65535, so unsigned 16 bit arithmetic is enough.
+static inline __m128i Luma8(__m128i r, __m128i g, __m128i b)
+{
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)), _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+    y = _mm_add_epi16(y, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(29)), _mm_set1_epi16(128)));
+    return _mm_srli_epi16(y, 8);
+}
+
+// A pair of 16 bit multipliers for _mm_madd_epi16.
+static inline __m128i Pair(int a, int b)
+{
+    return _mm_set1_epi32((int)((uint16_t)a | ((uint32_t)(uint16_t)b << 16)));
+}
+
+// 4 chroma values from the 32 bit sums of 4 2x2 blocks.
+static inline __m128i Chroma4(__m128i sumR, __m128i sumG, __m128i sumB, __m128i rg, __m128i b1)
+{
+    __m128i rgPairs = _mm_unpacklo_epi16(_mm_packs_epi32(sumR, sumR), _mm_packs_epi32(sumG, sumG));
+    __m128i b1Pairs = _mm_unpacklo_epi16(_mm_packs_epi32(sumB, sumB), _mm_set1_epi16(1));
+    __m128i c = _mm_add_epi32(_mm_madd_epi16(rgPairs, rg), _mm_madd_epi16(b1Pairs, b1));
+    c = _mm_add_epi32(_mm_srai_epi32(c, 10), _mm_set1_epi32(128));
+    c = _mm_packs_epi32(c, c);
+    return _mm_packus_epi16(c, c);
+}
+#endif
+
+void Pixie::ConvertToI420(const uint32_t* pixels, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v)
+{
+    int chromaWidth = (width + 1) / 2;
+
+    for (int py = 0; py < height; py += 2)
+    {
+        // An odd last row pairs with itself.
+        bool hasRow1 = py + 1 < height;
+        const uint32_t* row0 = pixels + (size_t)py * width;
+        const uint32_t* row1 = hasRow1 ? row0 + width : row0;
+        uint8_t* y0 = y + (size_t)py * width;
+        uint8_t* y1 = hasRow1 ? y0 + width : y0;
+        uint8_t* uRow = u + (size_t)(py / 2) * chromaWidth;
+        uint8_t* vRow = v + (size_t)(py / 2) * chromaWidth;
+
+        int x = 0;
+#if PIXIE_SSE2
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i blueRG = Pair(-43, -85), blueB1 = Pair(128, 512);
+        const __m128i redRG = Pair(128, -107), redB1 = Pair(-21, 512);
+        for ( ; x + 8 <= width; x += 8)
+        {
+            __m128i r0, g0, b0, r1, g1, b1;
+            SplitChannels(row0 + x, r0, g0, b0);
+            SplitChannels(row1 + x, r1, g1, b1);
+
+            __m128i luma0 = Luma8(r0, g0, b0);
+            __m128i luma1 = Luma8(r1, g1, b1);
+            _mm_storel_epi64((__m128i*)(y0 + x), _mm_packus_epi16(luma0, luma0));
+            _mm_storel_epi64((__m128i*)(y1 + x), _mm_packus_epi16(luma1, luma1));
+
+            // Add the rows, then neighbouring columns.
+            __m128i sumR = _mm_madd_epi16(_mm_add_epi16(r0, r1), ones);
+            __m128i sumG = _mm_madd_epi16(_mm_add_epi16(g0, g1), ones);
+            __m128i sumB = _mm_madd_epi16(_mm_add_epi16(b0, b1), ones);
+            int blue = _mm_cvtsi128_si32(Chroma4(sumR, sumG, sumB, blueRG, blueB1));
+            int red = _mm_cvtsi128_si32(Chroma4(sumR, sumG, sumB, redRG, redB1));
+            memcpy(uRow + x / 2, &blue, 4);
+            memcpy(vRow + x / 2, &red, 4);
+        }
+#endif
+        for ( ; x < width; x += 2)
+        {
+            // An odd last column pairs with itself.
+            int x1 = std::min(x + 1, width - 1);
+            uint32_t p[4] = { row0[x], row0[x1], row1[x], row1[x1] };
+            int sumR = 0, sumG = 0, sumB = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                sumR += (p[i] >> 16) & 0xff;
+                sumG += (p[i] >> 8) & 0xff;
+                sumB += p[i] & 0xff;
+            }
+
+            y0[x] = Luma((p[0] >> 16) & 0xff, (p[0] >> 8) & 0xff, p[0] & 0xff);
+            y0[x1] = Luma((p[1] >> 16) & 0xff, (p[1] >> 8) & 0xff, p[1] & 0xff);
+            y1[x] = Luma((p[2] >> 16) & 0xff, (p[2] >> 8) & 0xff, p[2] & 0xff);
+            y1[x1] = Luma((p[3] >> 16) & 0xff, (p[3] >> 8) & 0xff, p[3] & 0xff);
+            uRow[x / 2] = ChromaBlue(sumR, sumG, sumB);
+            vRow[x / 2] = ChromaRed(sumR, sumG, sumB);
+        }
+    }
+}
+
+Recorder::Recorder()
+{
+    m_file = 0;
+    m_isPipe = false;
+    m_format = RecordingFormat_RawRGBA;
+    m_policy = RecordingPolicy_Drop;
+    m_width = 0;
+    m_height = 0;
+    m_readIndex = 0;
+    m_writeIndex = 0;
+    m_numQueued = 0;
+    m_droppedFrameCount = 0;
+    m_stopping = false;
+    m_writeFailed = false;
+}
+
+Recorder::~Recorder()
+{
+    Stop();
+}
+
+bool Recorder::Start(const char* path, RecordingFormat format, RecordingPolicy policy, int width, int height, int frameRate)
+{
+    Stop();
+
+    // Capture files are written by the CaptureWriter, which needs to seek back to fill in the header.
+    m_isPipe = format == RecordingFormat_Pipe;
+    if (format == RecordingFormat_Capture)
+    {
+        if (!m_capture.Open(path, width, height))
+            return false;
+    }
+    else
+    {
+#if PIXIE_PLATFORM_WIN
+        m_file = m_isPipe ? popen(path, "wb") : fopen(path, "wb");
+#else
+        m_file = m_isPipe ? popen(path, "w") : fopen(path, "wb");
+#endif
+        if (!m_file)
+            return false;
+    }
+
+    m_format = format;
+    m_policy = policy;
+    m_width = width;
+    m_height = height;
+    m_readIndex = 0;
+    m_writeIndex = 0;
+    m_numQueued = 0;
+    m_droppedFrameCount = 0;
+    m_stopping = false;
+    m_writeFailed = false;
+
+    for (int i = 0; i < NumFrameBuffers; i++)
+        m_frames[i].resize((size_t)width * height);
+
+    if (format == RecordingFormat_RawRGBA)
+    {
+        m_conversion.resize((size_t)width * height * 4);
+    }
+    else if (format != RecordingFormat_Capture)
+    {
+        // Y4M carries the frame size and rate, so encoders reading it need no other options.
+        size_t chromaSize = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+        m_conversion.resize((size_t)width * height + 2 * chromaSize);
+        fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, frameRate);
+    }
+
+    m_thread = std::thread(&Recorder::WriterThread, this);
+    return true;
+}
+
+void Recorder::Stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_frameQueued.notify_one();
+    m_thread.join();
+
+    if (m_format == RecordingFormat_Capture)
+    {
+        m_capture.Close();
+    }
+    else if (m_isPipe)
+    {
+        // Closing flushes anything still buffered into the pipe.
+#if !PIXIE_PLATFORM_WIN
+        sigset_t previous;
+        BlockSigPipe(previous);
+        pclose(m_file);
+        RestoreSigPipe(previous);
+#else
+        pclose(m_file);
+#endif
+    }
+    else
+    {
+        fclose(m_file);
+    }
+    m_file = 0;
+
+    for (int i = 0; i < NumFrameBuffers; i++)
+        std::vector<uint32_t>().swap(m_frames[i]);
+    std::vector<uint8_t>().swap(m_conversion);
+}
+
+void Recorder::AddFrame(const uint32_t* pixels)
+{
+    if (!m_thread.joinable())
+        return;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_numQueued == NumFrameBuffers)
+    {
+        if (m_policy == RecordingPolicy_Drop)
+        {
+            m_droppedFrameCount++;
+            return;
+        }
+        m_frameWritten.wait(lock, [this]() { return m_numQueued < NumFrameBuffers; });
+    }
+
+    // There's only one producer, so the slot stays ours while copying without the lock.
+    std::vector<uint32_t>& frame = m_frames[m_writeIndex];
+    lock.unlock();
+    memcpy(frame.data(), pixels, frame.size() * sizeof(uint32_t));
+    lock.lock();
+
+    m_writeIndex = (m_writeIndex + 1) % NumFrameBuffers;
+    m_numQueued++;
+    lock.unlock();
+    m_frameQueued.notify_one();
+}
+
+uint32_t Recorder::GetDroppedFrameCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_droppedFrameCount;
+}
+
+void Recorder::WriterThread()
+{
+#if !PIXIE_PLATFORM_WIN
+    sigset_t previous;
+    BlockSigPipe(previous);
+#endif
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_frameQueued.wait(lock, [this]() { return m_numQueued > 0 || m_stopping; });
+        if (m_numQueued == 0)
+            break;
+
+        const std::vector<uint32_t>& frame = m_frames[m_readIndex];
+        lock.unlock();
+
+        // After a failed write (e.g. the encoder exited, so the pipe fails with EPIPE) frames are
+        // still taken off the queue, so a blocking AddFrame can't wait forever.
+        if (!m_writeFailed && !WriteFrame(frame.data()))
+            m_writeFailed = true;
+
+        lock.lock();
+        m_readIndex = (m_readIndex + 1) % NumFrameBuffers;
+        m_numQueued--;
+        m_frameWritten.notify_one();
+    }
+    lock.unlock();
+
+#if !PIXIE_PLATFORM_WIN
+    // Push out what's buffered while SIGPIPE is still blocked, leaving little for pclose.
+    if (m_file && !m_writeFailed)
+        fflush(m_file);
+    RestoreSigPipe(previous);
+#endif
+}
+
+bool Recorder::WriteFrame(const uint32_t* pixels)
+{
+    if (m_format == RecordingFormat_Capture)
+        return m_capture.AddFrame(pixels);
+
+    size_t numPixels = (size_t)m_width * m_height;
+    uint8_t* out = m_conversion.data();
+
+    if (m_format == RecordingFormat_RawRGBA)
+    {
+        for (size_t i = 0; i < numPixels; i++, out += 4)
+        {
+            uint32_t pixel = pixels[i];
+            out[0] = (uint8_t)(pixel >> 16);
+            out[1] = (uint8_t)(pixel >> 8);
+            out[2] = (uint8_t)pixel;
+            out[3] = 0xff;
+        }
+    }
+    else
+    {
+        size_t chromaSize = (size_t)((m_width + 1) / 2) * ((m_height + 1) / 2);
+        ConvertToI420(pixels, m_width, m_height, out, out + numPixels, out + numPixels + chromaSize);
+        if (fwrite("FRAME\n", 1, 6, m_file) != 6)
+            return false;
+    }
+
+    return fwrite(m_conversion.data(), 1, m_conversion.size(), m_file) == m_conversion.size();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "capture.h"
+#include "pixie.h"
+
+namespace Pixie
+{
+    // Streams frames to a file or an encoder process. Frames are copied into a ring of preallocated
+    // buffers and converted and written on a writer thread, so adding a frame costs one memcpy.
+    class Recorder
+    {
+        public:
+            Recorder();
+            ~Recorder();
+
+            // Opens the output and starts the writer thread. Every frame must be width x height.
+            bool Start(const char* path, RecordingFormat format, RecordingPolicy policy, int width, int height, int frameRate);
+
+            // Writes out the frames still queued, then closes the output.
+            void Stop();
+
+            // Queues a copy of the frame. If the ring is full the frame is dropped or this waits for
+            // the writer, depending on the policy.
+            void AddFrame(const uint32_t* pixels);
+
+            // Returns the number of frames dropped because the writer couldn't keep up.
+            uint32_t GetDroppedFrameCount() const;
+
+        private:
+            enum
+            {
+                NumFrameBuffers = 4
+            };
+
+            void WriterThread();
+            bool WriteFrame(const uint32_t* pixels);
+
+            FILE* m_file;
+            bool m_isPipe;
+            CaptureWriter m_capture;
+            RecordingFormat m_format;
+            RecordingPolicy m_policy;
+            int m_width;
+            int m_height;
+
+            std::vector<uint32_t> m_frames[NumFrameBuffers];
+            int m_readIndex;
+            int m_writeIndex;
+            int m_numQueued;
+            uint32_t m_droppedFrameCount;
+            bool m_stopping;
+
+            // Only touched by the writer thread.
+            std::vector<uint8_t> m_conversion;
+            bool m_writeFailed;
+
+            mutable std::mutex m_mutex;
+            std::condition_variable m_frameQueued;
+            std::condition_variable m_frameWritten;
+            std::thread m_thread;
+    };
+
+    // Converts BGRx pixels to planar YUV 4:2:0 (full range BT.601). The chroma planes are
+    // ((width + 1) / 2) x ((height + 1) / 2). Uses SSE2 when available.
+    void ConvertToI420(const uint32_t* pixels, int width, int height, uint8_t* y, uint8_t* u, uint8_t* v);
+}
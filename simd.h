@@ -0,0 +1,30 @@
+#pragma once
+
+// Compiler and CPU feature checks shared by the SIMD pixel kernels.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXIE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if PIXIE_X86 && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PIXIE_SSE2 1
+#endif
+
+// AVX2 kernels are compiled for AVX2 regardless of the compiler flags and only called if the CPU has it.
+#if defined(__GNUC__) || defined(__clang__)
+#define PIXIE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PIXIE_TARGET_AVX2
+#endif
+
+namespace Pixie
+{
+#if PIXIE_X86
+    // Returns true if the CPU and OS support AVX2.
+    bool CpuHasAVX2();
+#endif
+}
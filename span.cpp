@@ -0,0 +1,509 @@
+#include "span.h"
+#include "simd.h"
+
+using namespace Pixie;
+
+// Spans at least this long (in pixels) bypass the cache with streaming stores. Below this the
+// pixels are likely to be drawn over again soon, so keeping them in cache is the better deal.
+static const int StreamingFillThreshold = 2 * 1024 * 1024;
+
+typedef void (*FillSpanFunc)(uint32_t* dst, int count, uint32_t colour);
+typedef void (*FillSpanMaskedFunc)(uint32_t* dst, uint32_t mask, uint32_t colour);
+typedef void (*CopySpanKeyedFunc)(uint32_t* dst, const uint32_t* src, int count, uint32_t key);
+typedef void (*CompositeSpanFunc)(uint32_t* dst, const uint32_t* src, int count);
+
+static void FillSpanScalar(uint32_t* dst, int count, uint32_t colour)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = colour;
+}
+
+static void FillSpanMaskedScalar(uint32_t* dst, uint32_t mask, uint32_t colour)
+{
+    for ( ; mask; mask >>= 1, dst++)
+    {
+        if (mask & 1)
+            *dst = colour;
+    }
+}
+
+static void CopySpanKeyedScalar(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if ((src[i] & 0x00ffffff) != key)
+            dst[i] = src[i];
+    }
+}
+
+// Adds two pixels, clamping each channel at 255.
+static inline uint32_t AddSaturate(uint32_t a, uint32_t b)
+{
+    uint32_t rb = (a & 0x00ff00ff) + (b & 0x00ff00ff);
+    uint32_t ag = ((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff);
+    rb |= ((rb >> 8) & 0x00010001)*0xff;
+    ag |= ((ag >> 8) & 0x00010001)*0xff;
+    return (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+}
+
+// Multiplies the two channels held in the low bytes of each half of pair by a/255, rounded.
+static inline uint32_t MulDiv255Pair(uint32_t pair, uint32_t a)
+{
+    uint32_t t = pair*a + 0x00800080;
+    return ((t + ((t >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
+static inline uint32_t BlendPremultiplied(uint32_t dst, uint32_t src)
+{
+    uint32_t inverse = 255 - (src >> 24);
+    uint32_t rest = MulDiv255Pair(dst & 0x00ff00ff, inverse) | (MulDiv255Pair((dst >> 8) & 0x00ff00ff, inverse) << 8);
+    return AddSaturate(src, rest);
+}
+
+static void BlendSpanPremultipliedScalar(uint32_t* dst, const uint32_t* src, int count)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = BlendPremultiplied(dst[i], src[i]);
+}
+
+static void AddSpanScalar(uint32_t* dst, const uint32_t* src, int count)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = AddSaturate(dst[i], src[i]);
+}
+
+#if PIXIE_SSE2
+static void FillSpanSSE2(uint32_t* dst, int count, uint32_t colour)
+{
+    // Align the destination so the main loop can use aligned (and streaming) stores.
+    while (count > 0 && ((uintptr_t)dst & 15) != 0)
+    {
+        *dst++ = colour;
+        count--;
+    }
+
+    __m128i c = _mm_set1_epi32((int)colour);
+    if (count >= StreamingFillThreshold)
+    {
+        for ( ; count >= 4; count -= 4, dst += 4)
+            _mm_stream_si128((__m128i*)dst, c);
+        _mm_sfence();
+    }
+    else
+    {
+        for ( ; count >= 16; count -= 16, dst += 16)
+        {
+            _mm_store_si128((__m128i*)dst, c);
+            _mm_store_si128((__m128i*)(dst + 4), c);
+            _mm_store_si128((__m128i*)(dst + 8), c);
+            _mm_store_si128((__m128i*)(dst + 12), c);
+        }
+        for ( ; count >= 4; count -= 4, dst += 4)
+            _mm_store_si128((__m128i*)dst, c);
+    }
+
+    while (count-- > 0)
+        *dst++ = colour;
+}
+#endif
+
+#if PIXIE_SSE2
+// Blends a pair of pixels, unpacked to 16 bits per channel, with their alphas.
+static inline __m128i Blend2(__m128i dst, __m128i colour, __m128i alpha)
+{
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(256), alpha);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(colour, alpha), _mm_mullo_epi16(dst, inverse)), 8);
+}
+
+static void BlendSpanSSE2(uint32_t* dst, int count, uint32_t colour, uint32_t alpha)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32((int)colour), zero);
+    __m128i a = _mm_set1_epi16((short)alpha);
+    for ( ; count >= 4; count -= 4, dst += 4)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        __m128i lo = Blend2(_mm_unpacklo_epi8(d, zero), c, a);
+        __m128i hi = Blend2(_mm_unpackhi_epi8(d, zero), c, a);
+        _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+    }
+
+    for ( ; count > 0; count--, dst++)
+        *dst = BlendColour(*dst, colour, alpha);
+}
+
+static void BlendSpanAlphaSSE2(uint32_t* dst, const uint16_t* alpha, int count, uint32_t colour)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32((int)colour), zero);
+    for ( ; count >= 4; count -= 4, dst += 4, alpha += 4)
+    {
+        // Spread each pixel's alpha over its four channels.
+        __m128i a = _mm_loadl_epi64((const __m128i*)alpha);
+        a = _mm_unpacklo_epi16(a, a);
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        __m128i lo = Blend2(_mm_unpacklo_epi8(d, zero), c, _mm_unpacklo_epi32(a, a));
+        __m128i hi = Blend2(_mm_unpackhi_epi8(d, zero), c, _mm_unpackhi_epi32(a, a));
+        _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+    }
+
+    for ( ; count > 0; count--, dst++, alpha++)
+        *dst = BlendColour(*dst, colour, *alpha);
+}
+
+static void CopySpanKeyedSSE2(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+{
+    __m128i rgb = _mm_set1_epi32(0x00ffffff);
+    __m128i k = _mm_set1_epi32((int)key);
+    for ( ; count >= 8; count -= 8, dst += 8, src += 8)
+    {
+        for (int i = 0; i < 8; i += 4)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i keyed = _mm_cmpeq_epi32(_mm_and_si128(s, rgb), k);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(keyed, d), _mm_andnot_si128(keyed, s)));
+        }
+    }
+
+    CopySpanKeyedScalar(dst, src, count, key);
+}
+
+// Multiplies 16 bit channels by the matching inverse alphas and divides by 255, rounded.
+static inline __m128i MulDiv255SSE2(__m128i channels, __m128i inverse)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(channels, inverse), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// Spreads each pixel's alpha over its four 16 bit channels and inverts it.
+static inline __m128i InverseAlphaSSE2(__m128i pixels)
+{
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+}
+
+static inline __m128i BlendPremultipliedSSE2(__m128i d, __m128i s)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = MulDiv255SSE2(_mm_unpacklo_epi8(d, zero), InverseAlphaSSE2(_mm_unpacklo_epi8(s, zero)));
+    __m128i hi = MulDiv255SSE2(_mm_unpackhi_epi8(d, zero), InverseAlphaSSE2(_mm_unpackhi_epi8(s, zero)));
+    return _mm_adds_epu8(s, _mm_packus_epi16(lo, hi));
+}
+
+static void BlendSpanPremultipliedSSE2(uint32_t* dst, const uint32_t* src, int count)
+{
+    __m128i alphaMask = _mm_set1_epi32((int)0xff000000);
+    for ( ; count >= 8; count -= 8, dst += 8, src += 8)
+    {
+        __m128i s0 = _mm_loadu_si128((const __m128i*)src);
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(src + 4));
+
+        // Sprites are mostly fully opaque or fully clear, which need no blending.
+        __m128i either = _mm_or_si128(s0, s1);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(either, _mm_setzero_si128())) == 0xffff)
+            continue;
+        __m128i both = _mm_and_si128(_mm_and_si128(s0, s1), alphaMask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(both, alphaMask)) == 0xffff)
+        {
+            _mm_storeu_si128((__m128i*)dst, s0);
+            _mm_storeu_si128((__m128i*)(dst + 4), s1);
+            continue;
+        }
+
+        __m128i d0 = _mm_loadu_si128((const __m128i*)dst);
+        __m128i d1 = _mm_loadu_si128((const __m128i*)(dst + 4));
+        _mm_storeu_si128((__m128i*)dst, BlendPremultipliedSSE2(d0, s0));
+        _mm_storeu_si128((__m128i*)(dst + 4), BlendPremultipliedSSE2(d1, s1));
+    }
+
+    BlendSpanPremultipliedScalar(dst, src, count);
+}
+
+static void AddSpanSSE2(uint32_t* dst, const uint32_t* src, int count)
+{
+    for ( ; count >= 8; count -= 8, dst += 8, src += 8)
+    {
+        __m128i d0 = _mm_loadu_si128((const __m128i*)dst);
+        __m128i d1 = _mm_loadu_si128((const __m128i*)(dst + 4));
+        _mm_storeu_si128((__m128i*)dst, _mm_adds_epu8(d0, _mm_loadu_si128((const __m128i*)src)));
+        _mm_storeu_si128((__m128i*)(dst + 4), _mm_adds_epu8(d1, _mm_loadu_si128((const __m128i*)(src + 4))));
+    }
+
+    AddSpanScalar(dst, src, count);
+}
+#endif
+
+#if PIXIE_X86
+PIXIE_TARGET_AVX2 static void FillSpanAVX2(uint32_t* dst, int count, uint32_t colour)
+{
+    while (count > 0 && ((uintptr_t)dst & 31) != 0)
+    {
+        *dst++ = colour;
+        count--;
+    }
+
+    __m256i c = _mm256_set1_epi32((int)colour);
+    if (count >= StreamingFillThreshold)
+    {
+        for ( ; count >= 8; count -= 8, dst += 8)
+            _mm256_stream_si256((__m256i*)dst, c);
+        _mm_sfence();
+    }
+    else
+    {
+        for ( ; count >= 32; count -= 32, dst += 32)
+        {
+            _mm256_store_si256((__m256i*)dst, c);
+            _mm256_store_si256((__m256i*)(dst + 8), c);
+            _mm256_store_si256((__m256i*)(dst + 16), c);
+            _mm256_store_si256((__m256i*)(dst + 24), c);
+        }
+        for ( ; count >= 8; count -= 8, dst += 8)
+            _mm256_store_si256((__m256i*)dst, c);
+    }
+
+    while (count-- > 0)
+        *dst++ = colour;
+}
+
+PIXIE_TARGET_AVX2 static void FillSpanMaskedAVX2(uint32_t* dst, uint32_t mask, uint32_t colour)
+{
+    // Expand 8 mask bits at a time into lane masks. Lanes whose bit is clear aren't touched, so
+    // this never reads or writes past the last set bit.
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i c = _mm256_set1_epi32((int)colour);
+    for ( ; mask; mask >>= 8, dst += 8)
+    {
+        __m256i m = _mm256_and_si256(_mm256_set1_epi32((int)(mask & 0xff)), bits);
+        _mm256_maskstore_epi32((int*)dst, _mm256_cmpeq_epi32(m, bits), c);
+    }
+}
+
+PIXIE_TARGET_AVX2 static void CopySpanKeyedAVX2(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+{
+    __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+    __m256i k = _mm256_set1_epi32((int)key);
+    for ( ; count >= 8; count -= 8, dst += 8, src += 8)
+    {
+        // Masked stores leave the keyed pixels untouched without reading them.
+        __m256i s = _mm256_loadu_si256((const __m256i*)src);
+        __m256i keep = _mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_and_si256(s, rgb), k), _mm256_set1_epi32(-1));
+        _mm256_maskstore_epi32((int*)dst, keep, s);
+    }
+
+    CopySpanKeyedScalar(dst, src, count, key);
+}
+
+PIXIE_TARGET_AVX2 static inline __m256i MulDiv255AVX2(__m256i channels, __m256i inverse)
+{
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(channels, inverse), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+PIXIE_TARGET_AVX2 static inline __m256i InverseAlphaAVX2(__m256i pixels)
+{
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+}
+
+PIXIE_TARGET_AVX2 static void BlendSpanPremultipliedAVX2(uint32_t* dst, const uint32_t* src, int count)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i alphaMask = _mm256_set1_epi32((int)0xff000000);
+    for ( ; count >= 8; count -= 8, dst += 8, src += 8)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i*)src);
+        if (_mm256_testz_si256(s, s))
+            continue;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alphaMask), alphaMask)) == -1)
+        {
+            _mm256_storeu_si256((__m256i*)dst, s);
+            continue;
+        }
+
+        // Unpacking and packing both work within 128 bit lanes, so the pixels end up in order.
+        __m256i d = _mm256_loadu_si256((const __m256i*)dst);
+        __m256i lo = MulDiv255AVX2(_mm256_unpacklo_epi8(d, zero), InverseAlphaAVX2(_mm256_unpacklo_epi8(s, zero)));
+        __m256i hi = MulDiv255AVX2(_mm256_unpackhi_epi8(d, zero), InverseAlphaAVX2(_mm256_unpackhi_epi8(s, zero)));
+        _mm256_storeu_si256((__m256i*)dst, _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+
+    BlendSpanPremultipliedScalar(dst, src, count);
+}
+
+PIXIE_TARGET_AVX2 static void AddSpanAVX2(uint32_t* dst, const uint32_t* src, int count)
+{
+    for ( ; count >= 8; count -= 8, dst += 8, src += 8)
+    {
+        __m256i d = _mm256_loadu_si256((const __m256i*)dst);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_adds_epu8(d, _mm256_loadu_si256((const __m256i*)src)));
+    }
+
+    AddSpanScalar(dst, src, count);
+}
+
+bool Pixie::CpuHasAVX2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // AVX2 support, and the OS saving the YMM registers on context switches.
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    return avx2 && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static FillSpanFunc SelectFillSpan()
+{
+#if PIXIE_X86
+    if (CpuHasAVX2())
+        return FillSpanAVX2;
+#endif
+#if PIXIE_SSE2
+    return FillSpanSSE2;
+#else
+    return FillSpanScalar;
+#endif
+}
+
+static FillSpanMaskedFunc SelectFillSpanMasked()
+{
+#if PIXIE_X86
+    if (CpuHasAVX2())
+        return FillSpanMaskedAVX2;
+#endif
+    return FillSpanMaskedScalar;
+}
+
+static CopySpanKeyedFunc SelectCopySpanKeyed()
+{
+#if PIXIE_X86
+    if (CpuHasAVX2())
+        return CopySpanKeyedAVX2;
+#endif
+#if PIXIE_SSE2
+    return CopySpanKeyedSSE2;
+#else
+    return CopySpanKeyedScalar;
+#endif
+}
+
+static CompositeSpanFunc SelectBlendSpanPremultiplied()
+{
+#if PIXIE_X86
+    if (CpuHasAVX2())
+        return BlendSpanPremultipliedAVX2;
+#endif
+#if PIXIE_SSE2
+    return BlendSpanPremultipliedSSE2;
+#else
+    return BlendSpanPremultipliedScalar;
+#endif
+}
+
+static CompositeSpanFunc SelectAddSpan()
+{
+#if PIXIE_X86
+    if (CpuHasAVX2())
+        return AddSpanAVX2;
+#endif
+#if PIXIE_SSE2
+    return AddSpanSSE2;
+#else
+    return AddSpanScalar;
+#endif
+}
+
+void Pixie::FillSpan(uint32_t* dst, int count, uint32_t colour)
+{
+    // Short spans (e.g. the sides of a rect) aren't worth the indirect call.
+    if (count < 8)
+    {
+        FillSpanScalar(dst, count, colour);
+        return;
+    }
+
+    static const FillSpanFunc fillSpan = SelectFillSpan();
+    fillSpan(dst, count, colour);
+}
+
+void Pixie::FillSpanMasked(uint32_t* dst, uint32_t mask, uint32_t colour)
+{
+    static const FillSpanMaskedFunc fillSpanMasked = SelectFillSpanMasked();
+    fillSpanMasked(dst, mask, colour);
+}
+
+void Pixie::FillBlock(uint32_t* dst, int pitch, int width, int height, uint32_t colour)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    // A block spanning whole rows is one contiguous span.
+    if (width == pitch)
+    {
+        FillSpan(dst, width * height, colour);
+        return;
+    }
+
+    for (int y = 0; y < height; y++, dst += pitch)
+        FillSpan(dst, width, colour);
+}
+
+void Pixie::BlendSpan(uint32_t* dst, int count, uint32_t colour, uint32_t alpha)
+{
+#if PIXIE_SSE2
+    BlendSpanSSE2(dst, count, colour, alpha);
+#else
+    for (int i = 0; i < count; i++)
+        dst[i] = BlendColour(dst[i], colour, alpha);
+#endif
+}
+
+void Pixie::BlendSpanAlpha(uint32_t* dst, const uint16_t* alpha, int count, uint32_t colour)
+{
+#if PIXIE_SSE2
+    BlendSpanAlphaSSE2(dst, alpha, count, colour);
+#else
+    for (int i = 0; i < count; i++)
+        dst[i] = BlendColour(dst[i], colour, alpha[i]);
+#endif
+}
+
+void Pixie::CopySpanKeyed(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+{
+    static const CopySpanKeyedFunc copySpanKeyed = SelectCopySpanKeyed();
+    copySpanKeyed(dst, src, count, key & 0x00ffffff);
+}
+
+void Pixie::BlendSpanPremultiplied(uint32_t* dst, const uint32_t* src, int count)
+{
+    static const CompositeSpanFunc blendSpanPremultiplied = SelectBlendSpanPremultiplied();
+    blendSpanPremultiplied(dst, src, count);
+}
+
+void Pixie::AddSpan(uint32_t* dst, const uint32_t* src, int count)
+{
+    static const CompositeSpanFunc addSpan = SelectAddSpan();
+    addSpan(dst, src, count);
+}
+
+void Pixie::PremultiplyAlpha(uint32_t* pixels, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t alpha = pixels[i] >> 24;
+        uint32_t rb = MulDiv255Pair(pixels[i] & 0x00ff00ff, alpha);
+        uint32_t g = MulDiv255Pair((pixels[i] >> 8) & 0xff, alpha);
+        pixels[i] = (alpha << 24) | rb | (g << 8);
+    }
+}
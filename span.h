@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace Pixie
+{
+    // Fills count pixels starting at dst with colour. Uses AVX2 or SSE2 when the CPU has them,
+    // which is picked at runtime, and plain stores otherwise.
+    void FillSpan(uint32_t* dst, int count, uint32_t colour);
+
+    // Writes colour to dst[i] for every bit i set in mask, e.g. one scanline of a glyph.
+    void FillSpanMasked(uint32_t* dst, uint32_t mask, uint32_t colour);
+
+    // Fills a width x height block of pixels whose rows are pitch pixels apart. The block must
+    // already be clipped to the buffer.
+    void FillBlock(uint32_t* dst, int pitch, int width, int height, uint32_t colour);
+
+    // Blends colour over count pixels starting at dst. alpha runs from 0, which leaves the pixels
+    // as they are, to 256, which replaces them with colour. Uses SSE2 when the CPU has it.
+    void BlendSpan(uint32_t* dst, int count, uint32_t colour, uint32_t alpha);
+
+    // As BlendSpan, with an alpha per pixel, e.g. for the edges of an anti-aliased shape.
+    void BlendSpanAlpha(uint32_t* dst, const uint16_t* alpha, int count, uint32_t colour);
+
+    // Composites count pixels from src onto dst, 8 at a time with AVX2 or SSE2 when the CPU has
+    // them. The alpha is the top byte of each pixel.
+    // CopySpanKeyed copies the pixels whose colour (ignoring alpha) isn't key.
+    // BlendSpanPremultiplied draws src over dst, where src's colours are already multiplied by its
+    // alpha: dst = src + dst*(255 - alpha)/255, per channel and saturated.
+    // AddSpan adds src to dst, per channel and saturated.
+    void CopySpanKeyed(uint32_t* dst, const uint32_t* src, int count, uint32_t key);
+    void BlendSpanPremultiplied(uint32_t* dst, const uint32_t* src, int count);
+    void AddSpan(uint32_t* dst, const uint32_t* src, int count);
+
+    // Multiplies the colour of count pixels by their alpha, e.g. to prepare images with straight
+    // alpha for BlendSpanPremultiplied.
+    void PremultiplyAlpha(uint32_t* pixels, int count);
+
+    // Blends colour over one pixel, as BlendSpan does.
+    inline uint32_t BlendColour(uint32_t dst, uint32_t colour, uint32_t alpha)
+    {
+        // Two channels at a time, each with 16 bits to work in.
+        uint32_t rb = ((colour & 0x00ff00ff)*alpha + (dst & 0x00ff00ff)*(256 - alpha)) >> 8;
+        uint32_t ag = ((colour >> 8) & 0x00ff00ff)*alpha + ((dst >> 8) & 0x00ff00ff)*(256 - alpha);
+        return (rb & 0x00ff00ff) | (ag & 0xff00ff00);
+    }
+}
@@ -0,0 +1,167 @@
+#include "sprite.h"
+#include "span.h"
+#include <string.h>
+#include <algorithm>
+
+using namespace Pixie;
+
+// Repeats of one colour at least this long are stored as fills, which are cheaper to draw and
+// to keep than copies.
+static const int MinFillLength = 8;
+
+// Copies up to this long are done in place rather than through memcpy.
+static const int ShortCopyLength = 8;
+
+RleSprite::RleSprite()
+{
+    m_width = 0;
+    m_height = 0;
+    m_mode = BlitMode_Copy;
+    m_colourKey = 0;
+    m_rowStarts.push_back(0);
+}
+
+RleSprite::RunType RleSprite::GetRunType(uint32_t pixel) const
+{
+    switch (m_mode)
+    {
+        case BlitMode_Copy:
+            return RunType_Copy;
+        case BlitMode_ColourKey:
+            return (pixel & 0x00ffffff) == m_colourKey ? RunType_Skip : RunType_Copy;
+        case BlitMode_Alpha:
+            if (pixel == 0)
+                return RunType_Skip;
+            return (pixel >> 24) == 0xff ? RunType_Copy : RunType_Blend;
+        case BlitMode_Add:
+            return pixel == 0 ? RunType_Skip : RunType_Add;
+    }
+    return RunType_Copy;
+}
+
+void RleSprite::AddRun(int x, int length, RunType type, const uint32_t* pixels)
+{
+    Run run;
+    run.x = x;
+    run.length = length;
+    run.type = type;
+    if (type == RunType_Fill)
+    {
+        run.data = pixels[0];
+    }
+    else
+    {
+        run.data = (uint32_t)m_pixels.size();
+        m_pixels.insert(m_pixels.end(), pixels, pixels + length);
+    }
+    m_runs.push_back(run);
+}
+
+void RleSprite::Encode(const DrawTarget& source, BlitMode mode, uint32_t colourKey /*= 0*/)
+{
+    m_width = source.clipX1 - source.clipX0;
+    m_height = source.clipY1 - source.clipY0;
+    m_mode = mode;
+    m_colourKey = colourKey & 0x00ffffff;
+    m_rowStarts.clear();
+    m_runs.clear();
+    m_pixels.clear();
+
+    for (int y = 0; y < m_height; y++)
+    {
+        m_rowStarts.push_back((int)m_runs.size());
+        const uint32_t* row = source.pixels + (source.clipY0 + y)*source.pitch + source.clipX0;
+
+        int x = 0;
+        while (x < m_width)
+        {
+            RunType type = GetRunType(row[x]);
+            int start = x;
+            while (x < m_width && GetRunType(row[x]) == type)
+                x++;
+            if (type != RunType_Skip && type != RunType_Copy)
+                AddRun(start, x - start, type, row + start);
+            if (type != RunType_Copy)
+                continue;
+
+            // Split copies around long repeats of one colour.
+            int copyStart = start;
+            for (int i = start; i < x; )
+            {
+                int repeat = i + 1;
+                while (repeat < x && row[repeat] == row[i])
+                    repeat++;
+                if (repeat - i >= MinFillLength)
+                {
+                    if (copyStart < i)
+                        AddRun(copyStart, i - copyStart, RunType_Copy, row + copyStart);
+                    AddRun(i, repeat - i, RunType_Fill, row + i);
+                    copyStart = repeat;
+                }
+                i = repeat;
+            }
+            if (copyStart < x)
+                AddRun(copyStart, x - copyStart, RunType_Copy, row + copyStart);
+        }
+    }
+    m_rowStarts.push_back((int)m_runs.size());
+}
+
+void RleSprite::Draw(const DrawTarget& target, int x, int y) const
+{
+    int top = std::max(y, target.clipY0);
+    int bottom = std::min(y + m_height, target.clipY1);
+    if (x >= target.clipX1 || x + m_width <= target.clipX0)
+        return;
+
+    for (int row = top; row < bottom; row++)
+    {
+        uint32_t* dst = target.pixels + row*target.pitch;
+        const Run* run = m_runs.data() + m_rowStarts[row - y];
+        const Run* end = m_runs.data() + m_rowStarts[row - y + 1];
+        for ( ; run < end; run++)
+        {
+            // Runs are in order, so everything after one starting right of the clip rect is too.
+            int left = x + run->x;
+            int right = left + run->length;
+            if (left >= target.clipX1)
+                break;
+            if (right <= target.clipX0)
+                continue;
+
+            int skip = std::max(target.clipX0 - left, 0);
+            left += skip;
+            int count = std::min(right, target.clipX1) - left;
+            if (run->type == RunType_Fill)
+            {
+                FillSpan(dst + left, count, run->data);
+                continue;
+            }
+
+            const uint32_t* src = m_pixels.data() + run->data + skip;
+            switch (run->type)
+            {
+                case RunType_Copy:
+                    // Most runs in sprites with thin features are only a few pixels long.
+                    if (count <= ShortCopyLength)
+                    {
+                        for (int i = 0; i < count; i++)
+                            dst[left + i] = src[i];
+                    }
+                    else
+                    {
+                        memcpy(dst + left, src, count*sizeof(uint32_t));
+                    }
+                    break;
+                case RunType_Blend:
+                    BlendSpanPremultiplied(dst + left, src, count);
+                    break;
+                case RunType_Add:
+                    AddSpan(dst + left, src, count);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
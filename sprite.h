@@ -0,0 +1,71 @@
+#pragma once
+
+#include "draw.h"
+#include <stdint.h>
+#include <vector>
+
+namespace Pixie
+{
+    // A sprite encoded as runs of pixels per row, leaving out the pixels that wouldn't change the
+    // target, so drawing it costs nothing for its transparent parts. Runs of one repeated colour
+    // are filled rather than copied. Encode once, e.g. when loading, and draw as often as needed.
+    class RleSprite
+    {
+        public:
+            RleSprite();
+
+            // Encodes the part of source inside its clip rect for drawing as Blit would with mode:
+            // BlitMode_ColourKey leaves out pixels whose colour, ignoring alpha, is colourKey,
+            // BlitMode_Alpha leaves out clear pixels (0, as the source is premultiplied) and copies
+            // opaque ones instead of blending them, and BlitMode_Add leaves out pixels that are 0.
+            void Encode(const DrawTarget& source, BlitMode mode, uint32_t colourKey = 0);
+
+            // Draws the sprite with its top left corner at (x, y), clipped to the target's clip rect.
+            void Draw(const DrawTarget& target, int x, int y) const;
+
+            int GetWidth() const;
+            int GetHeight() const;
+
+        private:
+            enum RunType
+            {
+                RunType_Skip = 0,
+                RunType_Copy,
+                RunType_Fill,
+                RunType_Blend,
+                RunType_Add
+            };
+
+            struct Run
+            {
+                int x;
+                int length;
+                RunType type;
+                // The colour for fills, otherwise the index of the run's first pixel in m_pixels.
+                uint32_t data;
+            };
+
+            RunType GetRunType(uint32_t pixel) const;
+            void AddRun(int x, int length, RunType type, const uint32_t* pixels);
+
+            int m_width;
+            int m_height;
+            BlitMode m_mode;
+            uint32_t m_colourKey;
+
+            // Row y's runs are m_runs[m_rowStarts[y]] up to m_runs[m_rowStarts[y + 1]], left to right.
+            std::vector<int> m_rowStarts;
+            std::vector<Run> m_runs;
+            std::vector<uint32_t> m_pixels;
+    };
+
+    inline int RleSprite::GetWidth() const
+    {
+        return m_width;
+    }
+
+    inline int RleSprite::GetHeight() const
+    {
+        return m_height;
+    }
+}